@@ -0,0 +1,163 @@
+/**
+ * \file affinity.cpp
+ * \brief Pinning of worker threads to CPUs and CPU topology lookup
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#include "affinity.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+
+using namespace std;
+
+/**
+ * \brief Parse non-negative CPU number.
+ */
+static bool parse_cpu(const string &str, int &cpu)
+{
+   char *end;
+   if (str.empty() || str[0] < '0' || str[0] > '9') {
+      return false;
+   }
+   long val = strtol(str.c_str(), &end, 10);
+   if (*end != '\0' || val >= CPU_SETSIZE) {
+      return false;
+   }
+   cpu = val;
+   return true;
+}
+
+bool parse_cpu_list(const string &str, vector<int> &cpus)
+{
+   istringstream list(str);
+   string item;
+
+   cpus.clear();
+   while (getline(list, item, ',')) {
+      size_t dash = item.find('-');
+      int first;
+      int last;
+      if (dash == string::npos) {
+         if (!parse_cpu(item, first)) {
+            return false;
+         }
+         last = first;
+      } else if (!parse_cpu(item.substr(0, dash), first) || !parse_cpu(item.substr(dash + 1), last) || last < first) {
+         return false;
+      }
+      for (int cpu = first; cpu <= last; cpu++) {
+         cpus.push_back(cpu);
+      }
+   }
+   return !cpus.empty();
+}
+
+vector<int> allowed_cpus()
+{
+   vector<int> cpus;
+#ifdef __linux__
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+         if (CPU_ISSET(cpu, &set)) {
+            cpus.push_back(cpu);
+         }
+      }
+   }
+#endif
+   return cpus;
+}
+
+int cpu_numa_node(int cpu)
+{
+   string path = "/sys/devices/system/cpu/cpu" + to_string(cpu);
+   DIR *dir = opendir(path.c_str());
+   int node = -1;
+
+   if (dir == NULL) {
+      return -1;
+   }
+   /* CPU directory contains link nodeN to its NUMA node. */
+   struct dirent *entry;
+   while ((entry = readdir(dir)) != NULL) {
+      if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+         node = atoi(entry->d_name + 4);
+         break;
+      }
+   }
+   closedir(dir);
+   return node;
+}
+
+int take_cpu(vector<int> &cpus, int node)
+{
+   size_t idx = 0;
+
+   if (cpus.empty()) {
+      return -1;
+   }
+   if (node >= 0) {
+      for (size_t i = 0; i < cpus.size(); i++) {
+         if (cpu_numa_node(cpus[i]) == node) {
+            idx = i;
+            break;
+         }
+      }
+   }
+   int cpu = cpus[idx];
+   cpus.erase(cpus.begin() + idx);
+   return cpu;
+}
+
+bool pin_thread(thread &thread, int cpu)
+{
+#ifdef __linux__
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   CPU_SET(cpu, &set);
+   return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+   return false;
+#endif
+}
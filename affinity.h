@@ -0,0 +1,87 @@
+/**
+ * \file affinity.h
+ * \brief Pinning of worker threads to CPUs and CPU topology lookup
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <string>
+#include <vector>
+#include <thread>
+
+/**
+ * \brief Parse list of CPUs.
+ * \param [in] str Comma separated CPU numbers and ranges, e.g. 0-3,8,10-11.
+ * \param [out] cpus CPUs in order of the list.
+ * \return True on success.
+ */
+bool parse_cpu_list(const std::string &str, std::vector<int> &cpus);
+
+/**
+ * \brief Get CPUs the process is allowed to run on.
+ * \return Allowed CPUs in ascending order.
+ */
+std::vector<int> allowed_cpus();
+
+/**
+ * \brief Get NUMA node of CPU.
+ * \param [in] cpu CPU number.
+ * \return NUMA node or -1 when unknown.
+ */
+int cpu_numa_node(int cpu);
+
+/**
+ * \brief Take CPU from list of free CPUs, preferably one on given NUMA node.
+ * \param [in,out] cpus Free CPUs, the returned one is removed.
+ * \param [in] node Preferred NUMA node, -1 for any.
+ * \return CPU number or -1 when no CPU is left.
+ */
+int take_cpu(std::vector<int> &cpus, int node);
+
+/**
+ * \brief Restrict thread to run on a single CPU.
+ * \param [in] thread Running thread.
+ * \param [in] cpu CPU number.
+ * \return True on success.
+ */
+bool pin_thread(std::thread &thread, int cpu);
+
+#endif
@@ -122,6 +122,19 @@ int BASICPLUSPlugin::pre_update(Flow &rec, Packet &pkt)
    return 0;
 }
 
+RecordExt *BASICPLUSPlugin::load_ext(extTypeEnum type, const uint8_t *buffer, int size)
+{
+   if (type != basicplus) {
+      return NULL;
+   }
+   RecordExtBASICPLUS *ext = new RecordExtBASICPLUS();
+   if (!ext->load(buffer, size)) {
+      delete ext;
+      return NULL;
+   }
+   return ext;
+}
+
 const char *ipfix_basicplus_template[] = {
    IPFIX_BASICPLUS_TEMPLATE(IPFIX_FIELD_NAMES)
    NULL
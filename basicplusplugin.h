@@ -126,6 +126,45 @@ struct RecordExtBASICPLUS : RecordExt {
 
       return 34;
    }
+
+   int saved_size() const
+   {
+      return sizeof(ip_ttl) + sizeof(ip_flg) + sizeof(tcp_win) + sizeof(tcp_opt) + sizeof(tcp_mss) +
+         sizeof(tcp_syn_size) + sizeof(dst_filled);
+   }
+
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      uint8_t *ptr = buffer;
+      if (size < saved_size()) {
+         return -1;
+      }
+
+      save_field(ptr, ip_ttl, sizeof(ip_ttl));
+      save_field(ptr, ip_flg, sizeof(ip_flg));
+      save_field(ptr, tcp_win, sizeof(tcp_win));
+      save_field(ptr, tcp_opt, sizeof(tcp_opt));
+      save_field(ptr, tcp_mss, sizeof(tcp_mss));
+      save_field(ptr, &tcp_syn_size, sizeof(tcp_syn_size));
+      save_field(ptr, &dst_filled, sizeof(dst_filled));
+      return ptr - buffer;
+   }
+
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      if (size != saved_size()) {
+         return false;
+      }
+
+      load_field(buffer, ip_ttl, sizeof(ip_ttl));
+      load_field(buffer, ip_flg, sizeof(ip_flg));
+      load_field(buffer, tcp_win, sizeof(tcp_win));
+      load_field(buffer, tcp_opt, sizeof(tcp_opt));
+      load_field(buffer, tcp_mss, sizeof(tcp_mss));
+      load_field(buffer, &tcp_syn_size, sizeof(tcp_syn_size));
+      load_field(buffer, &dst_filled, sizeof(dst_filled));
+      return true;
+   }
 };
 
 /**
@@ -139,6 +178,7 @@ public:
    FlowCachePlugin *copy();
    int post_create(Flow &rec, const Packet &pkt);
    int pre_update(Flow &rec, Packet &pkt);
+   RecordExt *load_ext(extTypeEnum type, const uint8_t *buffer, int size);
    const char **get_ipfix_string();
    string get_unirec_field_string();
 
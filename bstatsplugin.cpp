@@ -171,9 +171,20 @@ int BSTATSPlugin::pre_update(Flow &rec, Packet &pkt)
 
 int BSTATSPlugin::post_update(Flow &rec, const Packet &pkt)
 {
+   RecordExtBSTATS *bstats_record = static_cast<RecordExtBSTATS *>(rec.getExtension(bstats));
+
+   /* Packets beyond the full burst arrays of both directions are not recorded. */
+   if (bstats_record->burst_count[0] >= BSTATS_MAXELENCOUNT && bstats_record->burst_count[1] >= BSTATS_MAXELENCOUNT) {
+      return FLOW_PLUGIN_DONE;
+   }
    return 0;
 }
 
+bool BSTATSPlugin::can_finish() const
+{
+   return true;
+}
+
 void BSTATSPlugin::pre_export(Flow &rec)
 {
    RecordExtBSTATS *bstats_record = static_cast<RecordExtBSTATS *>(rec.getExtension(bstats));
@@ -185,6 +196,19 @@ void BSTATSPlugin::pre_export(Flow &rec)
    }
 }
 
+RecordExt *BSTATSPlugin::load_ext(extTypeEnum type, const uint8_t *buffer, int size)
+{
+   if (type != bstats) {
+      return NULL;
+   }
+   RecordExtBSTATS *ext = new RecordExtBSTATS();
+   if (!ext->load(buffer, size)) {
+      delete ext;
+      return NULL;
+   }
+   return ext;
+}
+
 const char *ipfix_bstats_template[] = {
    IPFIX_BSTATS_TEMPLATE(IPFIX_FIELD_NAMES)
    NULL
@@ -173,6 +173,43 @@ struct RecordExtBSTATS : RecordExt {
 
       return bufferPtr;
    }
+
+   int saved_size() const
+   {
+      return sizeof(burst_count) + sizeof(burst_empty) + sizeof(brst_pkts) + sizeof(brst_bytes) +
+         sizeof(brst_start) + sizeof(brst_end);
+   }
+
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      uint8_t *ptr = buffer;
+      if (size < saved_size()) {
+         return -1;
+      }
+
+      save_field(ptr, burst_count, sizeof(burst_count));
+      save_field(ptr, burst_empty, sizeof(burst_empty));
+      save_field(ptr, brst_pkts, sizeof(brst_pkts));
+      save_field(ptr, brst_bytes, sizeof(brst_bytes));
+      save_field(ptr, brst_start, sizeof(brst_start));
+      save_field(ptr, brst_end, sizeof(brst_end));
+      return ptr - buffer;
+   }
+
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      if (size != saved_size()) {
+         return false;
+      }
+
+      load_field(buffer, burst_count, sizeof(burst_count));
+      load_field(buffer, burst_empty, sizeof(burst_empty));
+      load_field(buffer, brst_pkts, sizeof(brst_pkts));
+      load_field(buffer, brst_bytes, sizeof(brst_bytes));
+      load_field(buffer, brst_start, sizeof(brst_start));
+      load_field(buffer, brst_end, sizeof(brst_end));
+      return burst_count[BSTATS_SOURCE] <= BSTATS_MAXELENCOUNT && burst_count[BSTATS_DEST] <= BSTATS_MAXELENCOUNT;
+   }
 };
 
 /**
@@ -188,7 +225,9 @@ public:
    int post_create(Flow &rec, const Packet &pkt);
    int pre_update(Flow &rec, Packet &pkt);
    int post_update(Flow &rec, const Packet &pkt);
+   bool can_finish() const;
    void pre_export(Flow &rec);
+   RecordExt *load_ext(extTypeEnum type, const uint8_t *buffer, int size);
    const char **get_ipfix_string();
    string get_unirec_field_string();
 
@@ -0,0 +1,230 @@
+/**
+ * \file cachemem.cpp
+ * \brief Allocation of flow cache storage backed by hugepages on a given NUMA node
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#include "cachemem.h"
+
+#include <fstream>
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+/* Memory policy constants from linux/mempolicy.h, libnuma is not required. */
+#define CACHE_MPOL_PREFERRED 1
+#define CACHE_MPOL_F_NODE (1 << 0)
+#define CACHE_MPOL_F_ADDR (1 << 1)
+#define CACHE_MAX_NUMA_NODES 1024
+
+#define HUGE_2M_SIZE (2UL << 20)
+#define HUGE_1G_SIZE (1UL << 30)
+
+static size_t round_up(size_t size, size_t align)
+{
+   return (size + align - 1) & ~(align - 1);
+}
+
+static void *map_region(size_t size, int flags)
+{
+   void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+   return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/**
+ * \brief Set preferred NUMA node of not yet touched memory region.
+ * Preferred policy is used so the cache still works when the node runs out of memory.
+ */
+static bool bind_region(void *ptr, size_t size, int node)
+{
+#ifdef SYS_mbind
+   const size_t bits = 8 * sizeof(unsigned long);
+   unsigned long mask[CACHE_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+
+   if (node < 0 || node >= CACHE_MAX_NUMA_NODES) {
+      return false;
+   }
+   memset(mask, 0, sizeof(mask));
+   mask[node / bits] |= 1UL << (node % bits);
+   /* Kernel ignores the last bit of maxnode. */
+   return syscall(SYS_mbind, ptr, size, CACHE_MPOL_PREFERRED, mask, CACHE_MAX_NUMA_NODES + 1, 0) == 0;
+#else
+   return false;
+#endif
+}
+
+bool cache_mem_alloc(CacheMem &mem, size_t size, cache_mem_type type, int node)
+{
+   mem.ptr = NULL;
+   mem.node = -1;
+
+   if (type == CACHE_MEM_HUGE_1G) {
+      mem.size = round_up(size, HUGE_1G_SIZE);
+      mem.backing = CACHE_MEM_HUGE_1G;
+      mem.ptr = map_region(mem.size, MAP_HUGETLB | MAP_HUGE_1GB);
+   }
+   if (mem.ptr == NULL && (type == CACHE_MEM_HUGE_1G || type == CACHE_MEM_HUGE_2M)) {
+      mem.size = round_up(size, HUGE_2M_SIZE);
+      mem.backing = CACHE_MEM_HUGE_2M;
+      mem.ptr = map_region(mem.size, MAP_HUGETLB | MAP_HUGE_2MB);
+   }
+   if (mem.ptr == NULL) {
+      mem.size = round_up(size, type == CACHE_MEM_DEFAULT ? sysconf(_SC_PAGESIZE) : HUGE_2M_SIZE);
+      mem.backing = CACHE_MEM_DEFAULT;
+      mem.ptr = map_region(mem.size, 0);
+      if (mem.ptr == NULL) {
+         mem.size = 0;
+         return false;
+      }
+#ifdef MADV_HUGEPAGE
+      if (type != CACHE_MEM_DEFAULT && madvise(mem.ptr, mem.size, MADV_HUGEPAGE) == 0) {
+         mem.backing = CACHE_MEM_THP;
+      }
+#endif
+   }
+
+   if (node >= 0 && bind_region(mem.ptr, mem.size, node)) {
+      mem.node = node;
+   }
+   return true;
+}
+
+bool cache_mem_reserve(CacheMem &mem, size_t size, cache_mem_type type, int node)
+{
+   mem.node = -1;
+   mem.size = round_up(size, type == CACHE_MEM_DEFAULT ? sysconf(_SC_PAGESIZE) : HUGE_2M_SIZE);
+   mem.backing = CACHE_MEM_DEFAULT;
+   mem.ptr = map_region(mem.size, MAP_NORESERVE);
+   if (mem.ptr == NULL) {
+      mem.size = 0;
+      return false;
+   }
+#ifdef MADV_HUGEPAGE
+   if (type != CACHE_MEM_DEFAULT && madvise(mem.ptr, mem.size, MADV_HUGEPAGE) == 0) {
+      mem.backing = CACHE_MEM_THP;
+   }
+#endif
+
+   if (node >= 0 && bind_region(mem.ptr, mem.size, node)) {
+      mem.node = node;
+   }
+   return true;
+}
+
+void cache_mem_free(CacheMem &mem)
+{
+   if (mem.ptr != NULL) {
+      munmap(mem.ptr, mem.size);
+      mem.ptr = NULL;
+      mem.size = 0;
+   }
+}
+
+int cache_mem_node(const void *ptr)
+{
+#ifdef SYS_get_mempolicy
+   int node = -1;
+   if (syscall(SYS_get_mempolicy, &node, NULL, 0, ptr, CACHE_MPOL_F_NODE | CACHE_MPOL_F_ADDR) == 0) {
+      return node;
+   }
+#endif
+   return -1;
+}
+
+bool str_to_cache_mem_type(const char *str, cache_mem_type &type)
+{
+   if (!strcasecmp(str, "none")) {
+      type = CACHE_MEM_DEFAULT;
+   } else if (!strcasecmp(str, "thp")) {
+      type = CACHE_MEM_THP;
+   } else if (!strcasecmp(str, "2M")) {
+      type = CACHE_MEM_HUGE_2M;
+   } else if (!strcasecmp(str, "1G")) {
+      type = CACHE_MEM_HUGE_1G;
+   } else {
+      return false;
+   }
+   return true;
+}
+
+const char *cache_mem_type_str(cache_mem_type type)
+{
+   switch (type) {
+   case CACHE_MEM_THP:
+      return "transparent hugepages";
+   case CACHE_MEM_HUGE_2M:
+      return "2MB hugepages";
+   case CACHE_MEM_HUGE_1G:
+      return "1GB hugepages";
+   default:
+      return "regular pages";
+   }
+}
+
+int ifc_numa_node(const string &ifc)
+{
+   string name = ifc.substr(0, ifc.find(':'));
+   string path;
+   int node = -1;
+
+   if (name.compare(0, 5, "/dev/") == 0) {
+      path = "/sys/class/nfb/" + name.substr(5) + "/device/numa_node";
+   } else {
+      path = "/sys/class/net/" + name + "/device/numa_node";
+   }
+
+   ifstream file(path.c_str());
+   if (!(file >> node)) {
+      return -1;
+   }
+   return node;
+}
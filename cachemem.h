@@ -0,0 +1,132 @@
+/**
+ * \file cachemem.h
+ * \brief Allocation of flow cache storage backed by hugepages on a given NUMA node
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#ifndef CACHEMEM_H
+#define CACHEMEM_H
+
+#include <string>
+#include <cstddef>
+
+/**
+ * \brief Requested or actual backing of flow cache memory.
+ */
+enum cache_mem_type {
+   CACHE_MEM_DEFAULT, /**< Regular pages. */
+   CACHE_MEM_THP, /**< Transparent hugepages (advised only). */
+   CACHE_MEM_HUGE_2M, /**< Explicit 2MB hugepages. */
+   CACHE_MEM_HUGE_1G /**< Explicit 1GB hugepages. */
+};
+
+/**
+ * \brief Anonymous memory region used for flow cache storage.
+ */
+struct CacheMem {
+   void *ptr; /**< Start of the region, zero filled. */
+   size_t size; /**< Mapped size rounded up to the page size. */
+   cache_mem_type backing; /**< Page type the region actually got. */
+   int node; /**< NUMA node the region is bound to, -1 if not bound. */
+
+   CacheMem() : ptr(NULL), size(0), backing(CACHE_MEM_DEFAULT), node(-1)
+   {
+   }
+};
+
+/**
+ * \brief Map zero filled memory for flow cache.
+ * Explicit hugepages fall back to transparent hugepages and then to regular pages when the
+ * system has no free hugepages of requested size.
+ * \param [out] mem Mapped region and its actual backing.
+ * \param [in] size Number of bytes to map.
+ * \param [in] type Requested backing.
+ * \param [in] node NUMA node to place memory on, -1 for default policy.
+ * \return True on success.
+ */
+bool cache_mem_alloc(CacheMem &mem, size_t size, cache_mem_type type, int node);
+
+/**
+ * \brief Reserve zero filled memory for flow cache without committing it.
+ * Pages are allocated as they are touched, so the region can be much larger than the memory in
+ * use. Explicit hugepages would be committed for the whole region, so transparent hugepages are
+ * advised instead.
+ * \param [out] mem Mapped region and its actual backing.
+ * \param [in] size Number of bytes to reserve.
+ * \param [in] type Requested backing.
+ * \param [in] node NUMA node to place memory on, -1 for default policy.
+ * \return True on success.
+ */
+bool cache_mem_reserve(CacheMem &mem, size_t size, cache_mem_type type, int node);
+
+/**
+ * \brief Unmap memory allocated by cache_mem_alloc or cache_mem_reserve.
+ * \param [in,out] mem Region to unmap.
+ */
+void cache_mem_free(CacheMem &mem);
+
+/**
+ * \brief Get NUMA node of page containing given address.
+ * \param [in] ptr Address of already touched memory.
+ * \return NUMA node or -1 when unknown.
+ */
+int cache_mem_node(const void *ptr);
+
+/**
+ * \brief Convert string to cache_mem_type.
+ * \param [in] str One of none, thp, 2M or 1G.
+ * \param [out] type Parsed value.
+ * \return True on success.
+ */
+bool str_to_cache_mem_type(const char *str, cache_mem_type &type);
+
+/**
+ * \brief Get human readable name of memory backing.
+ * \param [in] type Memory backing.
+ * \return Name of the backing.
+ */
+const char *cache_mem_type_str(cache_mem_type type);
+
+/**
+ * \brief Get NUMA node of device behind capture interface.
+ * \param [in] ifc Network interface name or NDP device path with optional channel.
+ * \return NUMA node or -1 when unknown.
+ */
+int ifc_numa_node(const std::string &ifc);
+
+#endif
@@ -0,0 +1,345 @@
+/**
+ * \file cachesnapshot.cpp
+ * \brief Saving flow cache content to a memory-mapped file and loading it on the next start
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#include "cachesnapshot.h"
+
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xxhash.h"
+
+#define SNAPSHOT_EXT_MAX_SIZE 0xFFFF // Size of saved extension has to fit into snapshot_ext::size
+
+static size_t snapshot_align(size_t offset)
+{
+   return (offset + SNAPSHOT_ALIGN - 1) & ~((size_t) SNAPSHOT_ALIGN - 1);
+}
+
+SnapshotWriter::SnapshotWriter() : fd(-1), data(NULL), size(0), offset(0), config(0), flow_cnt(0)
+{
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+   if (fd >= 0) {
+      discard();
+   }
+}
+
+/**
+ * \brief Resize the file and map it again.
+ */
+bool SnapshotWriter::map(size_t new_size)
+{
+   if (data != NULL) {
+      munmap(data, size);
+      data = NULL;
+   }
+   if (ftruncate(fd, new_size) != 0) {
+      error_msg = string("unable to resize ") + tmp_path + ": " + strerror(errno);
+      return false;
+   }
+   void *ptr = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (ptr == MAP_FAILED) {
+      error_msg = string("unable to map ") + tmp_path + ": " + strerror(errno);
+      return false;
+   }
+   data = static_cast<uint8_t *>(ptr);
+   size = new_size;
+   return true;
+}
+
+/**
+ * \brief Remove unfinished snapshot file.
+ */
+void SnapshotWriter::discard()
+{
+   if (data != NULL) {
+      munmap(data, size);
+      data = NULL;
+   }
+   ::close(fd);
+   fd = -1;
+   unlink(tmp_path.c_str());
+}
+
+bool SnapshotWriter::open(const string &file, uint64_t cfg)
+{
+   path = file;
+   tmp_path = file + ".tmp";
+   config = cfg;
+   flow_cnt = 0;
+   offset = snapshot_align(sizeof(snapshot_header));
+
+   fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0) {
+      error_msg = string("unable to create ") + tmp_path + ": " + strerror(errno);
+      return false;
+   }
+   if (!map(SNAPSHOT_MIN_SIZE)) {
+      discard();
+      return false;
+   }
+   return true;
+}
+
+bool SnapshotWriter::save(const Flow &flow)
+{
+   if (data == NULL) {
+      return false;
+   }
+
+   size_t ext_start = snapshot_align(offset + sizeof(snapshot_flow));
+   size_t pos = ext_start;
+   for (RecordExt *ext = flow.exts; ext != NULL; ext = ext->next) {
+      /* Make room for the largest extension, so that save fails only for extensions that cannot be saved. */
+      size_t need = pos + sizeof(snapshot_ext) + SNAPSHOT_EXT_MAX_SIZE;
+      if (need > size && !map(need > 2 * size ? snapshot_align(need) : 2 * size)) {
+         return false;
+      }
+
+      int len = ext->save(data + pos + sizeof(snapshot_ext), SNAPSHOT_EXT_MAX_SIZE);
+      if (len < 0) {
+         return false;
+      }
+      snapshot_ext hdr = {static_cast<uint16_t>(ext->extType), static_cast<uint16_t>(len)};
+      memcpy(data + pos, &hdr, sizeof(hdr));
+      pos = snapshot_align(pos + sizeof(hdr) + len);
+   }
+   if (ext_start > size && !map(2 * size)) {
+      return false;
+   }
+
+   snapshot_flow rec;
+   memset(&rec, 0, sizeof(rec));
+   rec.time_first = flow.time_first;
+   rec.time_last = flow.time_last;
+   rec.src_octet_total_length = flow.src_octet_total_length;
+   rec.dst_octet_total_length = flow.dst_octet_total_length;
+   rec.src_pkt_total_cnt = flow.src_pkt_total_cnt;
+   rec.dst_pkt_total_cnt = flow.dst_pkt_total_cnt;
+   rec.sampling_interval = flow.sampling_interval;
+   rec.ext_size = pos - ext_start;
+   rec.src_ip = flow.src_ip;
+   rec.dst_ip = flow.dst_ip;
+   rec.src_port = flow.src_port;
+   rec.dst_port = flow.dst_port;
+   rec.ip_version = flow.ip_version;
+   rec.ip_proto = flow.ip_proto;
+   rec.src_tcp_control_bits = flow.src_tcp_control_bits;
+   rec.dst_tcp_control_bits = flow.dst_tcp_control_bits;
+   memcpy(rec.src_mac, flow.src_mac, sizeof(rec.src_mac));
+   memcpy(rec.dst_mac, flow.dst_mac, sizeof(rec.dst_mac));
+   memcpy(data + offset, &rec, sizeof(rec));
+
+   offset = pos;
+   flow_cnt++;
+   return true;
+}
+
+bool SnapshotWriter::close()
+{
+   if (data == NULL) {
+      if (fd >= 0) {
+         discard();
+      }
+      return false;
+   }
+
+   snapshot_header hdr = {SNAPSHOT_MAGIC, config, flow_cnt, offset};
+   memcpy(data, &hdr, sizeof(hdr));
+   bool ok = msync(data, offset, MS_SYNC) == 0;
+   munmap(data, size);
+   data = NULL;
+   ok = ok && ftruncate(fd, offset) == 0 && fsync(fd) == 0;
+   if (!ok) {
+      error_msg = string("unable to write ") + tmp_path + ": " + strerror(errno);
+      discard();
+      return false;
+   }
+
+   ::close(fd);
+   fd = -1;
+   if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+      error_msg = string("unable to rename ") + tmp_path + ": " + strerror(errno);
+      unlink(tmp_path.c_str());
+      return false;
+   }
+   return true;
+}
+
+SnapshotReader::SnapshotReader() : data(NULL), size(0), offset(0), ext_offset(0), ext_end(0)
+{
+}
+
+SnapshotReader::~SnapshotReader()
+{
+   if (data != NULL) {
+      munmap(data, size);
+   }
+}
+
+bool SnapshotReader::open(const string &file, uint64_t cfg)
+{
+   int fd = ::open(file.c_str(), O_RDONLY);
+   if (fd < 0) {
+      if (errno != ENOENT) {
+         error_msg = string("unable to open ") + file + ": " + strerror(errno);
+      }
+      return false;
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(snapshot_header)) {
+      error_msg = file + " is not a flow cache snapshot";
+      ::close(fd);
+      return false;
+   }
+   void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   ::close(fd);
+   if (ptr == MAP_FAILED) {
+      error_msg = string("unable to map ") + file + ": " + strerror(errno);
+      return false;
+   }
+   data = static_cast<uint8_t *>(ptr);
+   size = st.st_size;
+
+   snapshot_header hdr;
+   memcpy(&hdr, data, sizeof(hdr));
+   if (hdr.magic != SNAPSHOT_MAGIC || hdr.size > size) {
+      error_msg = file + " is not a flow cache snapshot";
+      return false;
+   }
+   if (hdr.config != cfg) {
+      /* File is kept, it can still be restored with the settings it was created with. */
+      error_msg = file + " was created with different flow key, thread or plugin settings";
+      return false;
+   }
+
+   if (unlink(file.c_str()) != 0) {
+      error_msg = string("unable to remove ") + file + ": " + strerror(errno);
+      return false;
+   }
+   size = hdr.size;
+   offset = snapshot_align(sizeof(snapshot_header));
+   return true;
+}
+
+bool SnapshotReader::load(Flow &flow)
+{
+   if (data == NULL || offset + sizeof(snapshot_flow) > size) {
+      return false;
+   }
+
+   snapshot_flow rec;
+   memcpy(&rec, data + offset, sizeof(rec));
+   ext_offset = snapshot_align(offset + sizeof(snapshot_flow));
+   ext_end = ext_offset + rec.ext_size;
+   if (ext_end > size) {
+      return false;
+   }
+   offset = ext_end;
+
+   flow.time_first = rec.time_first;
+   flow.time_last = rec.time_last;
+   flow.src_octet_total_length = rec.src_octet_total_length;
+   flow.dst_octet_total_length = rec.dst_octet_total_length;
+   flow.src_pkt_total_cnt = rec.src_pkt_total_cnt;
+   flow.dst_pkt_total_cnt = rec.dst_pkt_total_cnt;
+   flow.sampling_interval = rec.sampling_interval;
+   flow.src_ip = rec.src_ip;
+   flow.dst_ip = rec.dst_ip;
+   flow.src_port = rec.src_port;
+   flow.dst_port = rec.dst_port;
+   flow.ip_version = rec.ip_version;
+   flow.ip_proto = rec.ip_proto;
+   flow.src_tcp_control_bits = rec.src_tcp_control_bits;
+   flow.dst_tcp_control_bits = rec.dst_tcp_control_bits;
+   memcpy(flow.src_mac, rec.src_mac, sizeof(flow.src_mac));
+   memcpy(flow.dst_mac, rec.dst_mac, sizeof(flow.dst_mac));
+   flow.end_reason = 0;
+   return true;
+}
+
+bool SnapshotReader::load_ext(extTypeEnum &type, const uint8_t *&buffer, int &len)
+{
+   snapshot_ext hdr;
+   if (ext_offset + sizeof(hdr) > ext_end) {
+      return false;
+   }
+   memcpy(&hdr, data + ext_offset, sizeof(hdr));
+   if (hdr.type >= EXTENSION_CNT || ext_offset + sizeof(hdr) + hdr.size > ext_end) {
+      return false;
+   }
+
+   type = static_cast<extTypeEnum>(hdr.type);
+   buffer = data + ext_offset + sizeof(hdr);
+   len = hdr.size;
+   ext_offset = snapshot_align(ext_offset + sizeof(hdr) + hdr.size);
+   return true;
+}
+
+uint64_t snapshot_config(const options_t &options, const vector<FlowCachePlugin *> &plugins)
+{
+   uint64_t ext_mask = 0;
+   for (size_t i = 0; i < plugins.size(); i++) {
+      const vector<plugin_opt> &opts = plugins[i]->get_options();
+      for (size_t j = 0; j < opts.size(); j++) {
+         ext_mask |= 1ULL << opts[j].ext_type;
+      }
+   }
+
+   const flow_aggregation &agg = options.aggregation;
+   uint64_t values[] = {
+      sizeof(snapshot_flow),
+      options.canonical_key,
+      agg.enabled,
+      agg.enabled ? (uint64_t) agg.src_prefix4 << 24 | agg.dst_prefix4 << 16 | agg.src_prefix6 << 8 | agg.dst_prefix6 : 0,
+      agg.enabled ? (uint64_t) agg.proto << 2 | agg.src_port << 1 | agg.dst_port : 0,
+      options.storage_threads,
+      ext_mask
+   };
+   return XXH64(values, sizeof(values), 0);
+}
@@ -0,0 +1,206 @@
+/**
+ * \file cachesnapshot.h
+ * \brief Saving flow cache content to a memory-mapped file and loading it on the next start
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#ifndef CACHESNAPSHOT_H
+#define CACHESNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "ipfixprobe.h"
+#include "flowifc.h"
+#include "flowcacheplugin.h"
+
+using namespace std;
+
+#define SNAPSHOT_MAGIC 0x31504e5358465049ULL // "IPFXSNP1"
+#define SNAPSHOT_ALIGN 8 // Flows and extensions start at multiples of this offset
+#define SNAPSHOT_MIN_SIZE (1 << 20) // Initial size of a snapshot file being written
+
+/**
+ * \brief Header at the start of a snapshot file.
+ */
+struct snapshot_header {
+   uint64_t magic;
+   uint64_t config; /**< Signature of settings the flows were created with, see snapshot_config. */
+   uint64_t flow_cnt;
+   uint64_t size; /**< Bytes of the file holding header and flows. */
+};
+
+/**
+ * \brief Flow saved to a snapshot file, followed by ext_size bytes of its extensions.
+ */
+struct snapshot_flow {
+   struct timeval time_first;
+   struct timeval time_last;
+   uint64_t src_octet_total_length;
+   uint64_t dst_octet_total_length;
+   uint32_t src_pkt_total_cnt;
+   uint32_t dst_pkt_total_cnt;
+   uint32_t sampling_interval;
+   uint32_t ext_size;
+   ipaddr_t src_ip;
+   ipaddr_t dst_ip;
+   uint16_t src_port;
+   uint16_t dst_port;
+   uint8_t ip_version;
+   uint8_t ip_proto;
+   uint8_t src_tcp_control_bits;
+   uint8_t dst_tcp_control_bits;
+   uint8_t src_mac[6];
+   uint8_t dst_mac[6];
+};
+
+/**
+ * \brief Extension saved to a snapshot file, followed by size bytes saved by RecordExt::save.
+ */
+struct snapshot_ext {
+   uint16_t type;
+   uint16_t size;
+};
+
+/**
+ * \brief Writes flows to a snapshot file.
+ * File is written under a temporary name and renamed when complete, so that an interrupted
+ * shutdown never leaves a truncated snapshot behind.
+ */
+class SnapshotWriter
+{
+   string path;
+   string tmp_path;
+   int fd;
+   uint8_t *data;
+   size_t size; /**< Mapped size of the file. */
+   size_t offset; /**< End of the last saved flow. */
+   uint64_t config;
+   uint64_t flow_cnt;
+
+   bool map(size_t new_size);
+   void discard();
+public:
+   string error_msg;
+
+   SnapshotWriter();
+   ~SnapshotWriter();
+
+   /**
+    * \brief Create snapshot file.
+    * \param [in] file Path of the snapshot file.
+    * \param [in] cfg Signature of current settings, see snapshot_config.
+    * \return True on success.
+    */
+   bool open(const string &file, uint64_t cfg);
+
+   /**
+    * \brief Save flow with its extensions.
+    * Counters have to be stored in the flow already.
+    * \param [in] flow Flow to save.
+    * \return False when the flow was not saved, e.g. one of its extensions cannot be saved.
+    */
+   bool save(const Flow &flow);
+
+   /**
+    * \brief Write the header, flush the file to disk and give it its final name.
+    * \return True when the snapshot is complete. Flows saved so far are lost otherwise.
+    */
+   bool close();
+
+   uint64_t get_flow_cnt() const
+   {
+      return flow_cnt;
+   }
+};
+
+/**
+ * \brief Reads flows from a snapshot file.
+ * File is removed once mapped, so that the same flows are never restored twice.
+ */
+class SnapshotReader
+{
+   uint8_t *data;
+   size_t size;
+   size_t offset; /**< Start of the next flow. */
+   size_t ext_offset; /**< Next extension of the last loaded flow. */
+   size_t ext_end;
+public:
+   string error_msg;
+
+   SnapshotReader();
+   ~SnapshotReader();
+
+   /**
+    * \brief Map snapshot file.
+    * \param [in] file Path of the snapshot file.
+    * \param [in] cfg Signature of current settings, see snapshot_config.
+    * \return True on success. Missing file is not an error, error_msg stays empty then.
+    */
+   bool open(const string &file, uint64_t cfg);
+
+   /**
+    * \brief Load next flow without its extensions.
+    * \param [out] flow Flow filled with saved values, counters included.
+    * \return False when there are no more flows.
+    */
+   bool load(Flow &flow);
+
+   /**
+    * \brief Get next extension of the last loaded flow.
+    * \param [out] type Extension type.
+    * \param [out] buffer Saved extension data.
+    * \param [out] len Length of saved data.
+    * \return False when there are no more extensions.
+    */
+   bool load_ext(extTypeEnum &type, const uint8_t *&buffer, int &len);
+};
+
+/**
+ * \brief Compute signature of settings that flows in a snapshot depend on.
+ * Flow keys depend on key and aggregation settings, placement of flows on the number of storage
+ * threads and extensions on active plugins.
+ * \param [in] options Module options.
+ * \param [in] plugins Active plugins.
+ * \return Signature stored in snapshot header.
+ */
+uint64_t snapshot_config(const options_t &options, const vector<FlowCachePlugin *> &plugins);
+
+#endif
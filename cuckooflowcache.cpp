@@ -0,0 +1,765 @@
+/**
+ * \file cuckooflowcache.cpp
+ * \brief "CuckooFlowCache" implementing bucketized cuckoo hash table as flow cache
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <iostream>
+#include <sys/time.h>
+
+#include "ring.h"
+#include "cuckooflowcache.h"
+#include "cachesnapshot.h"
+#include "xxhash.h"
+
+using namespace std;
+
+CuckooFlowCache::CuckooFlowCache(const options_t &options, int numa_node) : pool(options.flow_cache_qsize)
+{
+   size = options.flow_cache_size;
+   ways = options.cache_ways;
+   bucket_mask = (size - 1) & ~(ways - 1);
+   stash_cnt = 0;
+   kick_pos = 0;
+   used = 0;
+   peak_used = 0;
+   restored = 0;
+   saved = 0;
+#ifdef FLOW_CACHE_STATS
+   hits = 0;
+   inserted = 0;
+   kicks = 0;
+   stashed = 0;
+   evicted = 0;
+   expired = 0;
+   flushed = 0;
+   collisions = 0;
+#endif /* FLOW_CACHE_STATS */
+   print_stats = options.print_stats;
+   /* Aggregation masks the key in flow direction, so both directions cannot share a canonical key. */
+   canonical_key = options.canonical_key && !options.aggregation.enabled;
+   aggregation = options.aggregation;
+   key_swapped = false;
+   active = options.active_timeout;
+   inactive = options.inactive_timeout;
+
+   /* Every slot and stash slot holds at most one record, one more is being inserted. */
+   size_t slots = size + CUCKOO_STASH_SIZE;
+   size_t records_cnt = slots + 1;
+   size_t array_offset = (slots * sizeof(uint64_t) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+   size_t states_offset = (array_offset + slots * sizeof(FlowRecord *) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+   size_t keys_offset = states_offset + records_cnt * sizeof(FlowState);
+   size_t records_offset = keys_offset + records_cnt * sizeof(FlowKey);
+   if (!cache_mem_alloc(mem, records_offset + records_cnt * sizeof(FlowRecord), options.cache_mem, numa_node)) {
+      throw bad_alloc();
+   }
+   hash_array = static_cast<uint64_t *>(mem.ptr);
+   flow_array = reinterpret_cast<FlowRecord **>(static_cast<char *>(mem.ptr) + array_offset);
+   flow_states = reinterpret_cast<FlowState *>(static_cast<char *>(mem.ptr) + states_offset);
+   flow_keys = reinterpret_cast<FlowKey *>(static_cast<char *>(mem.ptr) + keys_offset);
+   flow_records = reinterpret_cast<FlowRecord *>(static_cast<char *>(mem.ptr) + records_offset);
+   records_used = 0;
+
+   time_t max_timeout = active.tv_sec > inactive.tv_sec ? active.tv_sec : inactive.tv_sec;
+   timer_size = TIMER_WHEEL_MIN_SIZE;
+   while (timer_size < TIMER_WHEEL_MAX_SIZE && timer_size < max_timeout + 2) {
+      timer_size <<= 1;
+   }
+   timer_mask = timer_size - 1;
+   timer_time = 0;
+   timer_wheel = new vector<TimerEntry>[timer_size];
+}
+
+CuckooFlowCache::~CuckooFlowCache()
+{
+   delete [] timer_wheel;
+   for (unsigned int i = 0; i < records_used; i++) {
+      flow_records[i].~FlowRecord();
+   }
+   cache_mem_free(mem);
+}
+
+void CuckooFlowCache::init()
+{
+   plugins_init();
+   if (!snapshot_file.empty()) {
+      restore_snapshot();
+   }
+}
+
+void CuckooFlowCache::finish()
+{
+   plugins_finish();
+
+   if (!snapshot_file.empty() && snapshot_save) {
+      save_snapshot();
+   }
+
+   /* Flows which were not saved are exported. */
+   for (unsigned int i = 0; i < size + CUCKOO_STASH_SIZE; i++) {
+      if (hash_array[i]) {
+         sync_flow(flow_array[i]);
+         plugins_pre_export(flow_array[i]->flow);
+         flow_array[i]->flow.end_reason = FLOW_END_FORCED;
+         export_flow(i);
+#ifdef FLOW_CACHE_STATS
+         expired++;
+#endif /* FLOW_CACHE_STATS */
+      }
+   }
+
+   if (print_stats) {
+      print_report();
+   }
+}
+
+void CuckooFlowCache::export_flow(size_t index)
+{
+   export_record(flow_array[index]);
+   hash_array[index] = 0;
+   if (index >= size) {
+      stash_cnt--;
+   }
+}
+
+/**
+ * \brief Hand flow of a record over to the exporter and erase the record.
+ * Flow goes out in a flow taken from the pool, so the record can be reused right away.
+ * \param [in] rec Valid flow record.
+ */
+void CuckooFlowCache::export_record(FlowRecord *rec)
+{
+   FlowState &state = get_state(rec);
+   timer_cancel(state);
+   state.store(rec->flow);
+   PooledFlow *exported = pool.get();
+   static_cast<Flow &>(*exported) = rec->flow;
+   rec->flow.exts = NULL;
+   ipx_ring_push(export_queue, exported);
+   used--;
+   rec->erase();
+   state.erase();
+}
+
+/**
+ * \brief Get an erased record, constructing a new one when there is no spare one.
+ */
+FlowRecord *CuckooFlowCache::new_record()
+{
+   if (!free_records.empty()) {
+      FlowRecord *rec = free_records.back();
+      free_records.pop_back();
+      return rec;
+   }
+   return new (flow_records + records_used++) FlowRecord();
+}
+
+void CuckooFlowCache::flush(Packet &pkt, size_t flow_index, int ret, bool source_flow)
+{
+   /* Plugins may ask for another flush from post_create, repeat until they are satisfied. */
+   while (true) {
+#ifdef FLOW_CACHE_STATS
+      flushed++;
+#endif /* FLOW_CACHE_STATS */
+
+      if (ret != FLOW_FLUSH_WITH_REINSERT) {
+         flow_array[flow_index]->flow.end_reason = FLOW_END_FORCED;
+         export_flow(flow_index);
+         return;
+      }
+
+      FlowRecord *flow = flow_array[flow_index];
+      FlowState &state = get_state(flow);
+      state.store(flow->flow);
+      PooledFlow *exported = pool.get();
+      static_cast<Flow &>(*exported) = flow->flow;
+      exported->end_reason = FLOW_END_FORCED;
+      ipx_ring_push(export_queue, exported);
+      flow->flow.exts = NULL;
+
+      state.soft_clean(); // Clean counters, set time first to last
+      state.update(pkt, source_flow); // Set new counters from packet
+      sync_flow(flow);
+      ret = plugins_post_create(flow->flow, pkt);
+      if (!(ret & FLOW_FLUSH)) {
+         return;
+      }
+   }
+}
+
+int CuckooFlowCache::put_pkt(Packet &pkt)
+{
+   plugins_pre_create(pkt);
+
+   if (!create_hash_key(pkt)) {
+      return 0;
+   }
+
+   return process_pkt(pkt, XXH64(key, key_len, 0));
+}
+
+int CuckooFlowCache::put_pkts(PacketBlock &block)
+{
+   uint64_t hashes[PUT_PKTS_WINDOW];
+   char keys[PUT_PKTS_WINDOW][FLOW_KEY_SIZE];
+   bool swapped[PUT_PKTS_WINDOW];
+   bool valid[PUT_PKTS_WINDOW];
+
+   for (size_t begin = 0; begin < block.cnt; begin += PUT_PKTS_WINDOW) {
+      Packet *pkts = block.pkts + begin;
+      size_t cnt = block.cnt - begin < PUT_PKTS_WINDOW ? block.cnt - begin : PUT_PKTS_WINDOW;
+
+      for (size_t i = 0; i < cnt; i++) {
+         plugins_pre_create(pkts[i]);
+         valid[i] = create_hash_key(pkts[i]);
+         if (valid[i]) {
+            hashes[i] = XXH64(key, key_len, 0);
+            memcpy(keys[i], key, FLOW_KEY_SIZE);
+            swapped[i] = key_swapped;
+         }
+      }
+
+      /* Prefetch both buckets of every packet, most flows are found in the first one. */
+      for (size_t i = 0; i < cnt; i++) {
+         if (valid[i]) {
+            __builtin_prefetch(hash_array + bucket1(hashes[i]));
+            __builtin_prefetch(flow_array + bucket1(hashes[i]));
+            __builtin_prefetch(hash_array + bucket2(hashes[i]));
+         }
+      }
+
+      for (size_t i = 0; i < cnt; i++) {
+         if (valid[i]) {
+            memcpy(key, keys[i], FLOW_KEY_SIZE);
+            key_swapped = swapped[i];
+            process_pkt(pkts[i], hashes[i]);
+         }
+      }
+   }
+   return 0;
+}
+
+/**
+ * \brief Find flow among consecutive slots, hash tag matches are confirmed by the whole flow key.
+ * \param [in] first Index of the first slot.
+ * \param [in] cnt Number of slots.
+ * \param [in] hashval Hash of the flow key.
+ * \param [in] flow_key Flow key zero padded to FLOW_KEY_SIZE.
+ * \return Offset of the slot from first or cnt when flow is not there.
+ */
+uint32_t CuckooFlowCache::find_slot(uint32_t first, uint32_t cnt, uint64_t hashval, const char *flow_key)
+{
+   uint32_t i = find_tag(hash_array + first, cnt, hashval);
+   while (i < cnt) {
+      if (key_equal(get_key(flow_array[first + i]).data, flow_key)) {
+         break;
+      }
+#ifdef FLOW_CACHE_STATS
+      collisions++;
+#endif /* FLOW_CACHE_STATS */
+      i++;
+      i += find_tag(hash_array + first + i, cnt - i, hashval);
+   }
+   return i;
+}
+
+/**
+ * \brief Find slot of a flow.
+ * \param [in] hashval Hash of the flow key.
+ * \param [in] flow_key Flow key zero padded to FLOW_KEY_SIZE.
+ * \return Index to flow_array or size + CUCKOO_STASH_SIZE when flow is not in the cache.
+ */
+uint32_t CuckooFlowCache::find_flow(uint64_t hashval, const char *flow_key)
+{
+   uint32_t bucket = bucket1(hashval);
+   uint32_t i = find_slot(bucket, ways, hashval, flow_key);
+   if (i < ways) {
+      return bucket + i;
+   }
+
+   bucket = bucket2(hashval);
+   i = find_slot(bucket, ways, hashval, flow_key);
+   if (i < ways) {
+      return bucket + i;
+   }
+
+   if (stash_cnt) {
+      return size + find_slot(size, CUCKOO_STASH_SIZE, hashval, flow_key);
+   }
+   return size + CUCKOO_STASH_SIZE;
+}
+
+/**
+ * \brief Store record into an empty slot.
+ */
+void CuckooFlowCache::place(uint32_t index, uint64_t hashval, FlowRecord *rec)
+{
+   if (flow_array[index] != NULL) {
+      free_records.push_back(flow_array[index]);
+   }
+   flow_array[index] = rec;
+   hash_array[index] = hashval;
+}
+
+/**
+ * \brief Make room for a new flow in one of its buckets.
+ * Residents of full buckets are moved to their alternative buckets. When that fails, the flow
+ * left without a slot goes to the stash or, when the stash is full, is exported.
+ * \param [in] hashval Hash of the new flow key.
+ * \return Index to flow_array of erased record tagged by hashval.
+ */
+uint32_t CuckooFlowCache::insert_flow(uint64_t hashval)
+{
+   uint32_t first = bucket1(hashval);
+   uint32_t second = bucket2(hashval);
+   uint32_t i;
+   FlowRecord *rec = new_record();
+
+   /* Key is stored right away, the new flow is found by it after displacement. */
+   memcpy(get_key(rec).data, key, FLOW_KEY_SIZE);
+#ifdef FLOW_CACHE_STATS
+   inserted++;
+#endif /* FLOW_CACHE_STATS */
+   i = find_tag(hash_array + first, ways, 0);
+   if (i < ways) {
+      place(first + i, hashval, rec);
+      return first + i;
+   }
+   i = find_tag(hash_array + second, ways, 0);
+   if (i < ways) {
+      place(second + i, hashval, rec);
+      return second + i;
+   }
+
+   /* Both buckets are full, carry displaced flows to their alternative buckets. */
+   uint64_t homeless_hash = hashval;
+   FlowRecord *homeless = rec;
+   uint32_t bucket = first;
+   for (uint32_t kick = 0; kick < CUCKOO_MAX_KICKS; kick++) {
+      uint32_t victim = bucket + (kick_pos++ & (ways - 1));
+      std::swap(homeless_hash, hash_array[victim]);
+      std::swap(homeless, flow_array[victim]);
+#ifdef FLOW_CACHE_STATS
+      kicks++;
+#endif /* FLOW_CACHE_STATS */
+
+      bucket = bucket1(homeless_hash) == bucket ? bucket2(homeless_hash) : bucket1(homeless_hash);
+      i = find_tag(hash_array + bucket, ways, 0);
+      if (i < ways) {
+         place(bucket + i, homeless_hash, homeless);
+         return find_flow(hashval, key);
+      }
+   }
+
+   i = find_tag(hash_array + size, CUCKOO_STASH_SIZE, 0);
+   if (i < CUCKOO_STASH_SIZE) {
+      place(size + i, homeless_hash, homeless);
+      stash_cnt++;
+#ifdef FLOW_CACHE_STATS
+      stashed++;
+#endif /* FLOW_CACHE_STATS */
+      return find_flow(hashval, key);
+   }
+
+   if (homeless == rec) {
+      /* New flow itself was displaced, put it back in place of a resident of its first bucket. */
+      uint32_t victim = first + (kick_pos++ & (ways - 1));
+      std::swap(homeless_hash, hash_array[victim]);
+      std::swap(homeless, flow_array[victim]);
+   }
+   sync_flow(homeless);
+   plugins_pre_export(homeless->flow);
+   homeless->flow.end_reason = FLOW_END_NO_RES;
+   export_record(homeless);
+   free_records.push_back(homeless);
+#ifdef FLOW_CACHE_STATS
+   evicted++;
+#endif /* FLOW_CACHE_STATS */
+   return find_flow(hashval, key);
+}
+
+/**
+ * \brief Update flow cache with a packet, its key must be already created.
+ * \param [in] pkt Input parsed packet.
+ * \param [in] hashval Hash of the packet flow key.
+ * \return 0 on success.
+ */
+int CuckooFlowCache::process_pkt(Packet &pkt, uint64_t hashval)
+{
+   /* Packet is inserted again when its flow had to be exported first, e.g. on SYN after FIN
+    * or on inactive timeout. Key is kept, so pre_create plugins are not called again. */
+   while (!update_flow(pkt, hashval)) {
+   }
+
+   export_expired(pkt.timestamp.tv_sec);
+   return 0;
+}
+
+/**
+ * \brief Find or create flow record of a packet and update it.
+ * \param [in] pkt Input parsed packet.
+ * \param [in] hashval Hash of the packet flow key.
+ * \return False when flow record was exported and packet has to be inserted again.
+ */
+bool CuckooFlowCache::update_flow(Packet &pkt, uint64_t hashval)
+{
+   int ret;
+   FlowRecord *flow;
+   bool source_flow = true;
+   bool created = false;
+   uint32_t flow_index = find_flow(hashval, key);
+
+   /* Find inversed flow. Canonical key is the same for both directions, so there is nothing more to search. */
+   if (flow_index >= size + CUCKOO_STASH_SIZE && !canonical_key) {
+      uint64_t hashval_inv = XXH64(key_inv, fill_aggregated_key(key_inv, pkt, true, aggregation), 0);
+      flow_index = find_flow(hashval_inv, key_inv);
+      source_flow = false;
+   }
+
+   if (flow_index < size + CUCKOO_STASH_SIZE) {
+      flow = flow_array[flow_index];
+      if (canonical_key) {
+         source_flow = get_state(flow).is_source(key_swapped);
+      }
+#ifdef FLOW_CACHE_STATS
+      hits++;
+#endif /* FLOW_CACHE_STATS */
+   } else {
+      source_flow = true;
+      flow_index = insert_flow(hashval);
+      flow = flow_array[flow_index];
+      created = true;
+   }
+
+   pkt.source_pkt = source_flow;
+   FlowState &state = get_state(flow);
+
+   uint8_t flw_flags = source_flow ? state.src_tcp_control_bits : state.dst_tcp_control_bits;
+   /* Aggregates hold many connections, so TCP flags never end them. */
+   if ((pkt.tcp_control_bits & 0x02) && (flw_flags & (0x01 | 0x04)) && !aggregation.enabled) {
+      // Flows with FIN or RST TCP flags are exported when new SYN packet arrives
+      flow->flow.end_reason = FLOW_END_EOF;
+      export_flow(flow_index);
+      return false;
+   }
+
+   if (created) {
+      flow->create(pkt, hashval);
+      if (aggregation.enabled) {
+         aggregate_flow(flow->flow, aggregation);
+      }
+      state.create(pkt, key_swapped);
+      if (++used > peak_used) {
+         peak_used = used;
+      }
+      timer_schedule(state, flow_deadline(state));
+      sync_flow(flow);
+      ret = plugins_post_create(flow->flow, pkt);
+
+      if (ret & FLOW_FLUSH) {
+         export_flow(flow_index);
+#ifdef FLOW_CACHE_STATS
+         flushed++;
+#endif /* FLOW_CACHE_STATS */
+      }
+   } else {
+      if (pkt.timestamp.tv_sec - state.time_last.tv_sec >= inactive.tv_sec) {
+         flow->flow.end_reason = FLOW_END_INACTIVE;
+         sync_flow(flow);
+         plugins_pre_export(flow->flow);
+         export_flow(flow_index);
+#ifdef FLOW_CACHE_STATS
+         expired++;
+#endif /* FLOW_CACHE_STATS */
+         return false;
+      }
+      if (pkt.sampling_interval != flow->flow.sampling_interval) {
+         /* Adaptive sampling changed the interval, each record covers packets sampled at a single one. */
+         flow->flow.end_reason = FLOW_END_FORCED;
+         sync_flow(flow);
+         plugins_pre_export(flow->flow);
+         export_flow(flow_index);
+#ifdef FLOW_CACHE_STATS
+         flushed++;
+#endif /* FLOW_CACHE_STATS */
+         return false;
+      }
+      ret = plugins_pre_update(flow->flow, pkt);
+      if (ret & FLOW_FLUSH) {
+         flush(pkt, flow_index, ret, source_flow);
+         return true;
+      } else {
+         state.update(pkt, source_flow);
+         sync_flow(flow);
+         ret = plugins_post_update(flow->flow, pkt);
+
+         if (ret & FLOW_FLUSH) {
+            flush(pkt, flow_index, ret, source_flow);
+            return true;
+         }
+      }
+
+      /* Check if flow record is expired. */
+      if (pkt.timestamp.tv_sec - state.time_first.tv_sec >= active.tv_sec) {
+         flow->flow.end_reason = FLOW_END_ACTIVE;
+         sync_flow(flow);
+         plugins_pre_export(flow->flow);
+         export_flow(flow_index);
+#ifdef FLOW_CACHE_STATS
+         expired++;
+#endif /* FLOW_CACHE_STATS */
+      }
+   }
+
+   return true;
+}
+
+void CuckooFlowCache::export_expired(time_t ts)
+{
+   if (ts <= timer_time) {
+      /* Time went backwards (e.g. idle wall clock followed by pcap timestamps), restart from here. */
+      timer_time = ts;
+      return;
+   }
+
+   /* Visit every second elapsed since the last call, at most one whole revolution. */
+   time_t first = ts - timer_time > timer_size ? ts - timer_size + 1 : timer_time + 1;
+   for (time_t t = first; t <= ts; t++) {
+      timer_batch.swap(timer_wheel[t & timer_mask]);
+      for (size_t i = 0; i < timer_batch.size(); i++) {
+         FlowState &state = flow_states[timer_batch[i].idx];
+         if (state.timer_seq != timer_batch[i].seq) {
+            continue; // Record was exported in the meantime
+         }
+
+         time_t deadline = flow_deadline(state);
+         if (deadline > ts) {
+            timer_schedule(state, deadline);
+            continue;
+         }
+
+         FlowRecord *rec = flow_records + timer_batch[i].idx;
+         if (ts - state.time_last.tv_sec >= inactive.tv_sec) {
+            rec->flow.end_reason = FLOW_END_INACTIVE;
+         } else {
+            rec->flow.end_reason = FLOW_END_ACTIVE;
+         }
+         size_t flow_index = find_flow_index(rec);
+         if (flow_index >= size + CUCKOO_STASH_SIZE) {
+            /* Record is not in the table, do not touch the slot of another flow, keep it scheduled for a retry. */
+            timer_schedule(state, ts + 1);
+            continue;
+         }
+         sync_flow(rec);
+         plugins_pre_export(rec->flow);
+         export_flow(flow_index);
+#ifdef FLOW_CACHE_STATS
+         expired++;
+#endif /* FLOW_CACHE_STATS */
+      }
+      timer_batch.clear();
+   }
+
+   timer_time = ts;
+}
+
+/**
+ * \brief Find cache slot holding given record.
+ * \param [in] rec Flow record stored in the cache.
+ * \return Index to flow_array or size + CUCKOO_STASH_SIZE when record is not in the cache.
+ */
+size_t CuckooFlowCache::find_flow_index(const FlowRecord *rec) const
+{
+   uint32_t buckets[2] = {bucket1(rec->get_hash()), bucket2(rec->get_hash())};
+
+   for (int b = 0; b < 2; b++) {
+      for (uint32_t i = buckets[b]; i < buckets[b] + ways; i++) {
+         if (flow_array[i] == rec) {
+            return i;
+         }
+      }
+   }
+   for (uint32_t i = size; i < size + CUCKOO_STASH_SIZE; i++) {
+      if (flow_array[i] == rec) {
+         return i;
+      }
+   }
+   return size + CUCKOO_STASH_SIZE;
+}
+
+/**
+ * \brief Get time when flow record expires on inactive or active timeout.
+ */
+time_t CuckooFlowCache::flow_deadline(const FlowState &state) const
+{
+   time_t inactive_deadline = state.time_last.tv_sec + inactive.tv_sec;
+   time_t active_deadline = state.time_first.tv_sec + active.tv_sec;
+   return inactive_deadline < active_deadline ? inactive_deadline : active_deadline;
+}
+
+void CuckooFlowCache::timer_schedule(FlowState &state, time_t deadline)
+{
+   TimerEntry entry = {static_cast<uint32_t>(&state - flow_states), ++state.timer_seq};
+   timer_wheel[deadline & timer_mask].push_back(entry);
+}
+
+void CuckooFlowCache::timer_cancel(FlowState &state)
+{
+   state.timer_seq++;
+}
+
+/**
+ * \brief Save flows to the snapshot file and remove them from the cache without exporting them.
+ * Flows with extensions that cannot be saved stay in the cache.
+ */
+void CuckooFlowCache::save_snapshot()
+{
+   SnapshotWriter writer;
+   vector<uint32_t> indexes;
+
+   if (!writer.open(snapshot_file, snapshot_cfg)) {
+      cerr << "Warning: flow cache snapshot not saved, " << writer.error_msg << endl;
+      return;
+   }
+   for (uint32_t i = 0; i < size + CUCKOO_STASH_SIZE; i++) {
+      if (hash_array[i]) {
+         FlowRecord *rec = flow_array[i];
+         get_state(rec).store(rec->flow);
+         if (writer.save(rec->flow)) {
+            indexes.push_back(i);
+         }
+      }
+   }
+   if (!writer.close()) {
+      cerr << "Warning: flow cache snapshot not saved, " << writer.error_msg << endl;
+      return;
+   }
+
+   for (size_t i = 0; i < indexes.size(); i++) {
+      FlowRecord *rec = flow_array[indexes[i]];
+      FlowState &state = get_state(rec);
+      timer_cancel(state);
+      rec->erase();
+      state.erase();
+      hash_array[indexes[i]] = 0;
+      if (indexes[i] >= size) {
+         stash_cnt--;
+      }
+      used--;
+   }
+   saved = indexes.size();
+}
+
+/**
+ * \brief Insert flows saved to the snapshot file by the previous run.
+ * Timeouts continue from saved timestamps, flows which expired meanwhile are exported by the first
+ * call of export_expired.
+ */
+void CuckooFlowCache::restore_snapshot()
+{
+   SnapshotReader reader;
+   Flow flow;
+   Packet pkt;
+   extTypeEnum type;
+   const uint8_t *buffer;
+   int len;
+
+   if (!reader.open(snapshot_file, snapshot_cfg)) {
+      if (!reader.error_msg.empty()) {
+         cerr << "Warning: flow cache snapshot not restored, " << reader.error_msg << endl;
+      }
+      return;
+   }
+   while (reader.load(flow)) {
+      bool valid = true;
+      while (valid && reader.load_ext(type, buffer, len)) {
+         RecordExt *ext = plugins_load_ext(type, buffer, len);
+         if (ext != NULL) {
+            flow.addExtension(ext);
+         } else {
+            valid = false;
+         }
+      }
+      fill_key_fields(pkt, flow);
+      if (!valid || !create_hash_key(pkt)) {
+         flow.removeExtensions();
+         continue;
+      }
+
+      uint64_t hashval = XXH64(key, key_len, 0);
+      uint32_t flow_index = insert_flow(hashval);
+      FlowRecord *rec = flow_array[flow_index];
+      FlowState &state = get_state(rec);
+      rec->restore(flow, hashval);
+      state.restore(rec->flow, key_swapped);
+      if (++used > peak_used) {
+         peak_used = used;
+      }
+      restored++;
+      timer_schedule(state, flow_deadline(state));
+   }
+}
+
+bool CuckooFlowCache::create_hash_key(const Packet &pkt)
+{
+   key_swapped = canonical_key && canonical_swap(pkt);
+   key_len = fill_aggregated_key(key, pkt, key_swapped, aggregation);
+   return key_len != 0;
+}
+
+void CuckooFlowCache::print_report()
+{
+   cout << "Cache memory: " << cache_mem_type_str(mem.backing) << ", " << mem.size << " bytes" << endl;
+   cout << "Peak load factor: " << float(peak_used) / size << endl;
+   cout << "Export pool: " << pool.size() << " flows" << endl;
+   if (!snapshot_file.empty()) {
+      cout << "Snapshot: " << restored << " flows restored, " << saved << " flows saved" << endl;
+   }
+
+#ifdef FLOW_CACHE_STATS
+   cout << "Hits: " << hits << endl;
+   cout << "Inserted: " << inserted << endl;
+   cout << "Kicks: " << kicks << endl;
+   cout << "Stashed: " << stashed << endl;
+   cout << "Evicted: " << evicted << endl;
+   cout << "Expired: " << expired << endl;
+   cout << "Flushed: " << flushed << endl;
+   cout << "Hash collisions: " << collisions << endl;
+#endif /* FLOW_CACHE_STATS */
+}
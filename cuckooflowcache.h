@@ -0,0 +1,167 @@
+/**
+ * \file cuckooflowcache.h
+ * \brief "CuckooFlowCache" implementing bucketized cuckoo hash table as flow cache
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#ifndef CUCKOOFLOWCACHE_H
+#define CUCKOOFLOWCACHE_H
+
+#include <vector>
+
+#include "ipfixprobe.h"
+#include "flowcache.h"
+#include "flowifc.h"
+#include "nhtflowcache.h"
+#include "cachemem.h"
+#include "flowpool.h"
+
+using namespace std;
+
+#define CUCKOO_STASH_SIZE 16 // Slots for flows which could not be placed into any of their buckets
+#define CUCKOO_MAX_KICKS 64 // Number of displacements tried before a flow goes to the stash
+
+/**
+ * \brief Flow cache storing every flow in one of two buckets of 4 or 8 slots.
+ * Full buckets make room by moving their residents to alternative buckets, so live flows are
+ * evicted only when displacement fails and the stash is full.
+ */
+class CuckooFlowCache : public FlowCache
+{
+   bool print_stats;
+   bool canonical_key;
+   flow_aggregation aggregation;
+   bool key_swapped;
+   uint8_t key_len;
+   uint32_t size;
+   uint32_t ways; /**< Number of slots in a bucket. */
+   uint32_t bucket_mask;
+   uint32_t stash_cnt; /**< Number of used stash slots. */
+   uint32_t kick_pos; /**< Rotates slot chosen as displacement victim. */
+   uint32_t used; /**< Number of valid flow records in the cache. */
+   uint32_t peak_used; /**< Highest value of used seen so far. */
+   uint64_t restored; /**< Flows restored from snapshot. */
+   uint64_t saved; /**< Flows saved to snapshot. */
+   uint32_t timer_size;
+   uint32_t timer_mask;
+   time_t timer_time; /**< Last second processed by the timeout wheel. */
+#ifdef FLOW_CACHE_STATS
+   uint64_t hits;
+   uint64_t inserted;
+   uint64_t kicks;
+   uint64_t stashed;
+   uint64_t evicted;
+   uint64_t expired;
+   uint64_t flushed;
+   uint64_t collisions;
+#endif /* FLOW_CACHE_STATS */
+   struct timeval active;
+   struct timeval inactive;
+   CacheMem mem; /**< Region holding all arrays of the cache. */
+   uint32_t records_used; /**< Number of flow_records constructed so far. */
+   char key[FLOW_KEY_SIZE];
+   char key_inv[FLOW_KEY_SIZE];
+   uint64_t *hash_array; /**< Hash tags of buckets followed by the stash, 0 marks an empty slot. */
+   FlowRecord **flow_array; /**< Records of buckets followed by the stash. */
+   FlowPool pool; /**< Exported flows until the exporter is done with them. */
+   FlowRecord *flow_records;
+   FlowState *flow_states; /**< Hot part of flow_records, indexed the same way. */
+   FlowKey *flow_keys; /**< Keys of flow_records, indexed the same way. */
+   vector<FlowRecord *> free_records; /**< Erased records taken out of slots filled by displacement. */
+   vector<TimerEntry> *timer_wheel; /**< Flow records indexed by second of their timeout deadline. */
+   vector<TimerEntry> timer_batch; /**< Entries of the wheel slot being processed. */
+
+public:
+   CuckooFlowCache(const options_t &options, int numa_node = -1);
+   ~CuckooFlowCache();
+
+   virtual int put_pkt(Packet &pkt);
+   virtual int put_pkts(PacketBlock &block);
+   virtual void init();
+   virtual void finish();
+
+   void export_expired(time_t ts);
+   void flush(Packet &pkt, size_t flow_index, int ret, bool source_flow);
+
+protected:
+   int process_pkt(Packet &pkt, uint64_t hashval);
+   bool update_flow(Packet &pkt, uint64_t hashval);
+   bool create_hash_key(const Packet &pkt);
+   uint32_t bucket1(uint64_t hashval) const
+   {
+      return hashval & bucket_mask;
+   }
+   uint32_t bucket2(uint64_t hashval) const
+   {
+      uint32_t bucket = (hashval >> 32) & bucket_mask;
+      return bucket != bucket1(hashval) ? bucket : (bucket + ways) & bucket_mask;
+   }
+   uint32_t find_slot(uint32_t first, uint32_t cnt, uint64_t hashval, const char *flow_key);
+   uint32_t find_flow(uint64_t hashval, const char *flow_key);
+   uint32_t insert_flow(uint64_t hashval);
+   void place(uint32_t index, uint64_t hashval, FlowRecord *rec);
+   void export_flow(size_t index);
+   void export_record(FlowRecord *rec);
+   FlowRecord *new_record();
+   FlowState &get_state(const FlowRecord *rec) const
+   {
+      return flow_states[rec - flow_records];
+   }
+   FlowKey &get_key(const FlowRecord *rec) const
+   {
+      return flow_keys[rec - flow_records];
+   }
+   /**
+    * \brief Copy counters of a record into its flow before a hook of plugins which read them.
+    */
+   void sync_flow(FlowRecord *rec) const
+   {
+      if (has_counter_readers()) {
+         get_state(rec).store(rec->flow);
+      }
+   }
+   size_t find_flow_index(const FlowRecord *rec) const;
+   time_t flow_deadline(const FlowState &state) const;
+   void timer_schedule(FlowState &state, time_t deadline);
+   void timer_cancel(FlowState &state);
+   void save_snapshot();
+   void restore_snapshot();
+   void print_report();
+};
+
+#endif
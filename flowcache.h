@@ -47,6 +47,7 @@
 #ifndef FLOWCACHE_H
 #define FLOWCACHE_H
 
+#include <string>
 #include <cstring>
 
 #include "ring.h"
@@ -64,12 +65,16 @@ class FlowCache
 {
 protected:
    ipx_ring_t *export_queue;
+   string snapshot_file; /**< Flows are saved here by finish and restored by init, empty when disabled. */
+   uint64_t snapshot_cfg; /**< Signature of settings stored in the snapshot. */
+   bool snapshot_save; /**< Finish saves flows to the snapshot instead of exporting them. */
 private:
    FlowCachePlugin **plugins; /**< Array of plugins. */
    uint32_t plugin_cnt;
+   uint32_t counter_readers; /**< Number of plugins which read flow counters. */
 
 public:
-   FlowCache() : plugins(NULL), plugin_cnt(0)
+   FlowCache() : snapshot_cfg(0), snapshot_save(false), plugins(NULL), plugin_cnt(0), counter_readers(0)
    {
    }
 
@@ -87,6 +92,20 @@ public:
     */
    virtual int put_pkt(Packet &pkt) = 0;
 
+   /**
+    * \brief Put block of packets into the cache.
+    * Implementations can override this to overlap work on several packets.
+    * \param [in] block Block of input parsed packets.
+    * \return 0 on success.
+    */
+   virtual int put_pkts(PacketBlock &block)
+   {
+      for (size_t i = 0; i < block.cnt; i++) {
+         put_pkt(block.pkts[i]);
+      }
+      return 0;
+   }
+
    /**
     * \brief Initialize flow cache.
     * Should be called before first call of recv_pkt, after all plugins are added.
@@ -113,10 +132,34 @@ public:
       export_queue = queue;
    }
 
+   /**
+    * \brief Keep flows in a snapshot file across restarts.
+    * Caches which support snapshots restore flows from the file in init and save them there
+    * instead of exporting them in finish.
+    * \param [in] file Path of the snapshot file.
+    * \param [in] cfg Signature of settings, see snapshot_config.
+    * \param [in] save Save flows in finish, otherwise they are only restored.
+    */
+   void set_snapshot(const string &file, uint64_t cfg, bool save = true)
+   {
+      snapshot_file = file;
+      snapshot_cfg = cfg;
+      snapshot_save = save;
+   }
+
    virtual void export_expired(time_t ts)
    {
    }
 
+   /**
+    * \brief Ask the cache to double or halve its size.
+    * Caches which support resizing may apply the change incrementally.
+    * \param [in] grow Grow when true, shrink otherwise.
+    */
+   virtual void resize(bool grow)
+   {
+   }
+
    /**
     * \brief Add plugin to internal list of plugins.
     * Plugins are always called in the same order, as they were added.
@@ -137,9 +180,20 @@ public:
          }
       }
       plugins[plugin_cnt++] = plugin;
+      if (plugin->reads_counters()) {
+         counter_readers++;
+      }
    }
 
 protected:
+   /**
+    * \brief Check whether any added plugin reads flow counters.
+    */
+   bool has_counter_readers() const
+   {
+      return counter_readers != 0;
+   }
+
    //Every FlowCache implementation should call these functions at appropriate places
 
    /**
@@ -200,12 +254,21 @@ protected:
     * \brief Call post_update function for each added plugin.
     * \param [in,out] rec Stored flow record.
     * \param [in] pkt Input parsed packet.
+    * \return Options for flow cache, FLOW_PLUGIN_DONE only when all plugins are done and none flushes.
     */
    int plugins_post_update(Flow &rec, const Packet &pkt)
    {
       int ret = 0;
+      unsigned int done = 0;
       for (unsigned int i = 0; i < plugin_cnt; i++) {
-         ret |= plugins[i]->post_update(rec, pkt);
+         int plugin_ret = plugins[i]->post_update(rec, pkt);
+         if (plugin_ret & FLOW_PLUGIN_DONE) {
+            done++;
+         }
+         ret |= plugin_ret & ~FLOW_PLUGIN_DONE;
+      }
+      if (done == plugin_cnt && !(ret & FLOW_FLUSH)) {
+         ret |= FLOW_PLUGIN_DONE;
       }
       return ret;
    }
@@ -221,6 +284,24 @@ protected:
       }
    }
 
+   /**
+    * \brief Recreate extension saved to a snapshot by the plugin which owns it.
+    * \param [in] type Type of saved extension.
+    * \param [in] buffer Saved data.
+    * \param [in] size Length of saved data.
+    * \return New extension or NULL when no plugin can load it.
+    */
+   RecordExt *plugins_load_ext(extTypeEnum type, const uint8_t *buffer, int size)
+   {
+      for (unsigned int i = 0; i < plugin_cnt; i++) {
+         RecordExt *ext = plugins[i]->load_ext(type, buffer, size);
+         if (ext != NULL) {
+            return ext;
+         }
+      }
+      return NULL;
+   }
+
    /**
     * \brief Call finish function for each added plugin.
     */
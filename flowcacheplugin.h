@@ -72,6 +72,13 @@
  */
 #define EXPORT_PACKET               0x4
 
+/**
+ * \brief Tell FlowCache that plugin needs no more pre_update and post_update calls for current flow.
+ * This return value has only effect when called from post_update method. When all plugins are done,
+ * FlowCache may update the flow without calling them until pre_export.
+ */
+#define FLOW_PLUGIN_DONE            0x8
+
 #define MAX_PAYLOAD_LENGTH MAXPCKTSIZE
 
 using namespace std;
@@ -160,13 +167,31 @@ public:
     * \brief Called after an existing record is updated.
     * \param [in,out] rec Reference to flow record.
     * \param [in,out] pkt Parsed packet.
-    * \return 0 on success or FLOW_FLUSH option.
+    * \return 0 on success, FLOW_FLUSH option or FLOW_PLUGIN_DONE.
     */
    virtual int post_update(Flow &rec, const Packet &pkt)
    {
       return 0;
    }
 
+   /**
+    * \brief Check whether plugin can be done with a flow before it is exported.
+    * \return True when post_update returns FLOW_PLUGIN_DONE once the plugin needs no more packets of a flow.
+    */
+   virtual bool can_finish() const
+   {
+      return false;
+   }
+
+   /**
+    * \brief Check whether plugin reads packet and byte counters, timestamps or TCP flags of a flow.
+    * \return True when the flow cache has to keep them up to date in post_create, post_update and pre_export.
+    */
+   virtual bool reads_counters() const
+   {
+      return false;
+   }
+
    /**
     * \brief Called before a flow record is exported from the cache.
     * \param [in,out] rec Reference to flow record.
@@ -175,6 +200,18 @@ public:
    {
    }
 
+   /**
+    * \brief Recreate extension of this plugin from flow cache snapshot.
+    * \param [in] type Type of saved extension.
+    * \param [in] buffer Data saved by RecordExt::save.
+    * \param [in] size Length of saved data.
+    * \return New extension or NULL when extension does not belong to this plugin.
+    */
+   virtual RecordExt *load_ext(extTypeEnum type, const uint8_t *buffer, int size)
+   {
+      return NULL;
+   }
+
    /**
     * \brief Called when everything is processed.
     */
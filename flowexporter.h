@@ -69,6 +69,22 @@ public:
     */
    virtual int export_flow(Flow &flow) = 0;
 
+   /**
+    * \brief Send batch of flow records to output interface.
+    * Exporters may override it to share per-flow work across the batch.
+    * \param [in] flows Flows to send.
+    * \param [in] cnt Number of flows.
+    * \return Number of flows that could not be exported.
+    */
+   virtual int export_flows(Flow **flows, int cnt)
+   {
+      int failed = 0;
+      for (int i = 0; i < cnt; i++) {
+         failed += export_flow(*flows[i]) != 0;
+      }
+      return failed;
+   }
+
    /**
     * \brief Force exporter to flush flows to collector.
     */
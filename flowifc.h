@@ -52,6 +52,7 @@
 #include <config.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 /* struct timeval */
 #include <sys/time.h>
 
@@ -145,6 +146,48 @@ struct RecordExt {
       return 0;
    }
 
+   /**
+    * \brief Save extension data to a flow cache snapshot.
+    * \param [out] buffer Snapshot buffer.
+    * \param [in] size Snapshot buffer size.
+    * \return Number of bytes written to buffer or -1 if extension cannot be saved.
+    */
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      return -1;
+   }
+
+   /**
+    * \brief Load extension data saved by save.
+    * \param [in] buffer Saved data.
+    * \param [in] size Length of saved data.
+    * \return True when data were loaded.
+    */
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      return false;
+   }
+
+protected:
+   /**
+    * \brief Append field to data saved by save and move past it.
+    */
+   static void save_field(uint8_t *&buffer, const void *field, size_t size)
+   {
+      memcpy(buffer, field, size);
+      buffer += size;
+   }
+
+   /**
+    * \brief Read field from data saved by save and move past it.
+    */
+   static void load_field(const uint8_t *&buffer, void *field, size_t size)
+   {
+      memcpy(field, buffer, size);
+      buffer += size;
+   }
+
+public:
    /**
     * \brief Virtual destructor.
     */
@@ -250,6 +293,7 @@ struct Flow : public Record {
    uint8_t src_mac[6];
    uint8_t dst_mac[6];
    uint8_t end_reason;
+   uint32_t sampling_interval;
 };
 
 #endif
@@ -0,0 +1,81 @@
+/**
+ * \file flowpool.cpp
+ * \brief Pool of exported flows handed over between flow cache and exporter
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#include "flowpool.h"
+
+FlowPool::FlowPool(size_t cnt) : free_list(NULL), returned(NULL), flow_cnt(0)
+{
+   grow(cnt > 0 ? cnt : FLOW_POOL_CHUNK);
+}
+
+FlowPool::~FlowPool()
+{
+   for (size_t i = 0; i < chunks.size(); i++) {
+      delete [] chunks[i];
+   }
+}
+
+/**
+ * \brief Allocate flows and add them to the free list.
+ */
+void FlowPool::grow(size_t cnt)
+{
+   PooledFlow *chunk = new PooledFlow[cnt];
+   chunks.push_back(chunk);
+   for (size_t i = 0; i < cnt; i++) {
+      chunk[i].pool = this;
+      chunk[i].pool_next = free_list;
+      free_list = chunk + i;
+   }
+   flow_cnt += cnt;
+}
+
+void FlowPool::release(Flow *flow)
+{
+   PooledFlow *pooled = static_cast<PooledFlow *>(flow);
+   FlowPool *pool = pooled->pool;
+
+   pooled->removeExtensions();
+   PooledFlow *head = pool->returned.load(std::memory_order_relaxed);
+   do {
+      pooled->pool_next = head;
+   } while (!pool->returned.compare_exchange_weak(head, pooled, std::memory_order_release, std::memory_order_relaxed));
+}
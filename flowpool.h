@@ -0,0 +1,120 @@
+/**
+ * \file flowpool.h
+ * \brief Pool of exported flows handed over between flow cache and exporter
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#ifndef FLOWPOOL_H
+#define FLOWPOOL_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+#include "flowifc.h"
+
+#define FLOW_POOL_CHUNK 1024 // Flows allocated at once when the pool runs dry
+
+class FlowPool;
+
+/**
+ * \brief Exported flow, owned by the exporter until it is released back to its pool.
+ * Every flow passed through the export queue is a PooledFlow.
+ */
+struct PooledFlow : public Flow {
+   PooledFlow *pool_next; /**< Next free flow of the pool. */
+   FlowPool *pool; /**< Pool the flow returns to. */
+};
+
+/**
+ * \brief Pool of flows exported by one flow cache.
+ * Cache takes flows from its private free list and exporters return them to a lock-free stack
+ * after serialization. When the free list is empty, the cache takes the whole stack at once.
+ * Cache is the only consumer, so the stack is free of the ABA problem. When exporters fall
+ * behind, the pool grows instead of blocking the cache or reusing flows still being exported.
+ */
+class FlowPool
+{
+   PooledFlow *free_list; /**< Flows owned by the cache. */
+   std::atomic<PooledFlow *> returned; /**< Flows released by exporters. */
+   std::vector<PooledFlow *> chunks;
+   size_t flow_cnt;
+
+   void grow(size_t cnt);
+public:
+   /**
+    * \brief Constructor.
+    * \param [in] cnt Number of flows allocated in advance, usually the export queue size.
+    */
+   FlowPool(size_t cnt);
+   ~FlowPool();
+
+   /**
+    * \brief Get an empty flow. Called by the owning cache only.
+    * \return Flow without extensions.
+    */
+   PooledFlow *get()
+   {
+      if (free_list == NULL) {
+         free_list = returned.exchange(NULL, std::memory_order_acquire);
+         if (free_list == NULL) {
+            grow(FLOW_POOL_CHUNK);
+         }
+      }
+      PooledFlow *flow = free_list;
+      free_list = flow->pool_next;
+      return flow;
+   }
+
+   /**
+    * \brief Return exported flow to its pool. Can be called by any thread.
+    * Extensions of the flow are deleted.
+    * \param [in] flow Flow taken from the export queue.
+    */
+   static void release(Flow *flow);
+
+   /**
+    * \brief Get number of flows allocated by the pool.
+    */
+   size_t size() const
+   {
+      return flow_cnt;
+   }
+};
+
+#endif
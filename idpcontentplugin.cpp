@@ -105,9 +105,18 @@ int IDPCONTENTPlugin::post_update(Flow &rec, const Packet &pkt)
 {
    RecordExtIDPCONTENT *idpcontent_data = static_cast<RecordExtIDPCONTENT *>(rec.getExtension(idpcontent));
    update_record(idpcontent_data, pkt);
+   /* Only the first content of each direction is exported. */
+   if (idpcontent_data->pkt_export_flg[0] && idpcontent_data->pkt_export_flg[1]) {
+      return FLOW_PLUGIN_DONE;
+   }
    return 0;
 }
 
+bool IDPCONTENTPlugin::can_finish() const
+{
+   return true;
+}
+
 const char *ipfix_idpcontent_template[] = {
    IPFIX_IDPCONTENT_TEMPLATE(IPFIX_FIELD_NAMES)
    NULL
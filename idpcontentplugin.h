@@ -118,6 +118,7 @@ public:
    FlowCachePlugin *copy();
    int post_create(Flow &rec, const Packet &pkt);
    int post_update(Flow &rec, const Packet &pkt);
+   bool can_finish() const;
    const char **get_ipfix_string();
    string get_unirec_field_string();
    void update_record(RecordExtIDPCONTENT *pstats_data, const Packet &pkt);
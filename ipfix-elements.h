@@ -92,6 +92,7 @@
 #define INPUT_INTERFACE(F)            F(0,       10,    2,   &this->dir_bit_field)
 #define OUTPUT_INTERFACE(F)           F(0,       14,    2,   NULL)
 #define FLOW_END_REASON(F)            F(0,      136,    1,   &flow.end_reason)
+#define SAMPLING_INTERVAL(F)          F(0,       34,    4,   &flow.sampling_interval)
 
 #define ETHERTYPE(F)                  F(0,      256,    2,   NULL)
 
@@ -298,6 +299,10 @@
    F(L2_SRC_MAC) \
    F(L2_DST_MAC)
 
+/* Appended to basic templates when flow sampling is enabled. */
+#define BASIC_TMPLT_SAMPLING(F) \
+   F(SAMPLING_INTERVAL)
+
 #define IPFIX_HTTP_TEMPLATE(F) \
    F(HTTP_USERAGENT) \
    F(HTTP_METHOD) \
@@ -454,6 +459,7 @@
 #define IPFIX_ENABLED_TEMPLATES(F) \
    BASIC_TMPLT_V4(F) \
    BASIC_TMPLT_V6(F) \
+   BASIC_TMPLT_SAMPLING(F) \
    IPFIX_HTTP_TEMPLATE(F) \
    IPFIX_RTSP_TEMPLATE(F) \
    IPFIX_TLS_TEMPLATE(F) \
@@ -122,6 +122,20 @@ const char *basic_tmplt_v6[] = {
    NULL
 };
 
+/* Basic IPv4 template of sampled flows. */
+const char *basic_tmplt_v4_sampling[] = {
+   BASIC_TMPLT_V4(IPFIX_FIELD_NAMES)
+   BASIC_TMPLT_SAMPLING(IPFIX_FIELD_NAMES)
+   NULL
+};
+
+/* Basic IPv6 template of sampled flows. */
+const char *basic_tmplt_v6_sampling[] = {
+   BASIC_TMPLT_V6(IPFIX_FIELD_NAMES)
+   BASIC_TMPLT_SAMPLING(IPFIX_FIELD_NAMES)
+   NULL
+};
+
 IPFIXExporter::IPFIXExporter()
 {
    flows_seen = 0;
@@ -147,6 +161,7 @@ IPFIXExporter::IPFIXExporter()
    templateRefreshTime = TEMPLATE_REFRESH_TIME;
    templateRefreshPackets = TEMPLATE_REFRESH_PACKETS;
    dir_bit_field = 0;
+   sampling = false;
    packetDataBuffer = NULL;
 }
 
@@ -215,19 +230,25 @@ std::vector<const char *> IPFIXExporter::get_template_fields(uint64_t tmpltId)
    return fields;
 }
 
-template_t *IPFIXExporter::get_template(Flow &flow)
+template_t *IPFIXExporter::get_template(uint64_t tmpltIdx, uint8_t ipVersion)
 {
-   int ipTmpltIdx = flow.ip_version == 6 ? TMPLT_IDX_V6 : TMPLT_IDX_V4;
-   uint64_t tmpltIdx = get_template_id(flow);
-   if (tmpltMap[ipTmpltIdx].find(tmpltIdx) == tmpltMap[ipTmpltIdx].end()) {
-      std::vector<const char *> fields = get_template_fields(tmpltIdx);
-      tmpltMap[TMPLT_IDX_V4][tmpltIdx] = create_template(basic_tmplt_v4, fields.data());
-      tmpltMap[TMPLT_IDX_V6][tmpltIdx] = create_template(basic_tmplt_v6, fields.data());
+   int ipTmpltIdx = ipVersion == 6 ? TMPLT_IDX_V6 : TMPLT_IDX_V4;
+   std::map<uint64_t, template_t *>::iterator it = tmpltMap[ipTmpltIdx].find(tmpltIdx);
+   if (it != tmpltMap[ipTmpltIdx].end()) {
+      return it->second;
    }
 
+   std::vector<const char *> fields = get_template_fields(tmpltIdx);
+   tmpltMap[TMPLT_IDX_V4][tmpltIdx] = create_template(sampling ? basic_tmplt_v4_sampling : basic_tmplt_v4, fields.data());
+   tmpltMap[TMPLT_IDX_V6][tmpltIdx] = create_template(sampling ? basic_tmplt_v6_sampling : basic_tmplt_v6, fields.data());
    return tmpltMap[ipTmpltIdx][tmpltIdx];
 }
 
+template_t *IPFIXExporter::get_template(Flow &flow)
+{
+   return get_template(get_template_id(flow), flow.ip_version);
+}
+
 int fill_extensions(RecordExt *ext, uint8_t *buffer, int size)
 {
    RecordExt *extensions[EXTENSION_CNT] = {0};
@@ -280,10 +301,9 @@ bool IPFIXExporter::fill_template(Flow &flow, template_t *tmplt)
    return true;
 }
 
-int IPFIXExporter::export_flow(Flow &flow)
+int IPFIXExporter::export_flow(Flow &flow, template_t *tmplt)
 {
    flows_seen++;
-   template_t *tmplt = get_template(flow);
    if (!fill_template(flow, tmplt)) {
       flush();
 
@@ -295,6 +315,40 @@ int IPFIXExporter::export_flow(Flow &flow)
    return 0;
 }
 
+int IPFIXExporter::export_flow(Flow &flow)
+{
+   return export_flow(flow, get_template(flow));
+}
+
+/**
+ * \brief Export batch of flows
+ *
+ * Template lookup is skipped for flows with the same extensions and IP version as the previous flow.
+ *
+ * @param flows Flows to export
+ * @param cnt Number of flows
+ * @return Number of flows that could not be exported
+ */
+int IPFIXExporter::export_flows(Flow **flows, int cnt)
+{
+   template_t *tmplt = NULL;
+   uint64_t tmpltIdx = 0;
+   uint8_t ipVersion = 0;
+   int failed = 0;
+
+   for (int i = 0; i < cnt; i++) {
+      Flow &flow = *flows[i];
+      uint64_t flowTmpltIdx = get_template_id(flow);
+      if (tmplt == NULL || flowTmpltIdx != tmpltIdx || flow.ip_version != ipVersion) {
+         tmpltIdx = flowTmpltIdx;
+         ipVersion = flow.ip_version;
+         tmplt = get_template(tmpltIdx, ipVersion);
+      }
+      failed += export_flow(flow, tmplt);
+   }
+   return failed;
+}
+
 /**
  * \brief Exporter initialization
  *
@@ -305,10 +359,11 @@ int IPFIXExporter::export_flow(Flow &flow)
  * @param port Collector port
  * @param udp Use UDP instead of TCP
  * @param mtu Size of packet payload sent
+ * @param sampling Export sampling interval of flows
  * @return Returns 0 on succes, non 0 otherwise.
  */
 int IPFIXExporter::init(const vector<FlowCachePlugin *> &plugins, int basic_num, uint32_t odid, string host, string port,
-   bool udp, uint16_t mtu, bool verbose, uint8_t dir)
+   bool udp, uint16_t mtu, bool verbose, uint8_t dir, bool sampling)
 {
    int ret;
 
@@ -324,6 +379,7 @@ int IPFIXExporter::init(const vector<FlowCachePlugin *> &plugins, int basic_num,
    this->mtu = mtu;
    basic_ifc_num = basic_num;
    this->dir_bit_field = dir;
+   this->sampling = sampling;
 
    if (mtu <= IPFIX_HEADER_SIZE) {
       fprintf(stderr, "Error: IPFIX message MTU should be at least %d bytes\n", IPFIX_HEADER_SIZE);
@@ -1002,6 +1058,10 @@ BASIC_TMPLT_V4(GEN_FILLFIELDS_INT) \
 BASIC_TMPLT_V6(GEN_FILLFIELDS_INT) \
 } while (0)
 
+#define GENERATE_FILL_FIELDS_SAMPLING() do { \
+BASIC_TMPLT_SAMPLING(GEN_FILLFIELDS_INT) \
+} while (0)
+
 #define GENERATE_FIELDS_SUMLEN(TMPL) TMPL(GEN_FIELDS_SUMLEN_INT) 0
 
 /**
@@ -1018,8 +1078,9 @@ int IPFIXExporter::fill_basic_flow(Flow &flow, template_t *tmplt)
 
    buffer = tmplt->buffer + tmplt->bufferSize;
    p = buffer;
+   int sampling_len = sampling ? GENERATE_FIELDS_SUMLEN(BASIC_TMPLT_SAMPLING) : 0;
    if (flow.ip_version == 4) {
-      if (tmplt->bufferSize + GENERATE_FIELDS_SUMLEN(BASIC_TMPLT_V4) > tmpltMaxBufferSize) {
+      if (tmplt->bufferSize + GENERATE_FIELDS_SUMLEN(BASIC_TMPLT_V4) + sampling_len > tmpltMaxBufferSize) {
          return -1;
       }
 
@@ -1037,7 +1098,7 @@ int IPFIXExporter::fill_basic_flow(Flow &flow, template_t *tmplt)
 #endif
 
    } else {
-      if (tmplt->bufferSize + GENERATE_FIELDS_SUMLEN(BASIC_TMPLT_V6) > tmpltMaxBufferSize) {
+      if (tmplt->bufferSize + GENERATE_FIELDS_SUMLEN(BASIC_TMPLT_V6) + sampling_len > tmpltMaxBufferSize) {
          return -1;
       }
 
@@ -1055,6 +1116,17 @@ int IPFIXExporter::fill_basic_flow(Flow &flow, template_t *tmplt)
 #endif
    }
 
+   if (sampling) {
+#if GCC_CHECK_PRAGMA
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wstrict-aliasing"
+#endif
+      GENERATE_FILL_FIELDS_SAMPLING();
+#if GCC_CHECK_PRAGMA
+# pragma GCC diagnostic pop
+#endif
+   }
+
    length = p - buffer;
 
    return length;
@@ -195,8 +195,9 @@ public:
    IPFIXExporter();
    ~IPFIXExporter();
    int export_flow(Flow &flow);
+   int export_flows(Flow **flows, int cnt);
    int init(const vector<FlowCachePlugin *> &plugins, int basic_ifc_num, uint32_t odid, string host, string port,
-      bool udp, uint16_t mtu, bool verbose, uint8_t dir = 1);
+      bool udp, uint16_t mtu, bool verbose, uint8_t dir = 1, bool sampling = false);
    void flush();
    void shutdown();
 private:
@@ -230,6 +231,7 @@ private:
    uint32_t templateRefreshTime; /**< UDP template refresh time interval */
    uint32_t templateRefreshPackets; /**< UDP template refresh packet interval */
    uint8_t dir_bit_field;     /**< Direction bit field value. */
+   bool sampling; /**< Export sampling interval of flows in basic templates. */
 
    uint16_t mtu; /**< Max size of packet payload sent */
    uint8_t *packetDataBuffer; /**< Data buffer to store packet */
@@ -254,9 +256,11 @@ private:
 
    uint64_t get_template_id(Record &flow);
    std::vector<const char *> get_template_fields(uint64_t tmpltId);
+   template_t *get_template(uint64_t tmpltId, uint8_t ipVersion);
    template_t *get_template(Flow &flow);
    template_t *get_template(Packet &pkt);
    bool fill_template(Flow &flow, template_t *tmplt);
+   int export_flow(Flow &flow, template_t *tmplt);
    bool fill_template(Packet &pkt, template_t *tmplt);
 };
 
@@ -52,6 +52,7 @@
 #include <vector>
 
 #include "flowcacheplugin.h"
+#include "cachemem.h"
 
 using namespace std;
 
@@ -88,6 +89,45 @@ static_assert(bitcount32(DEFAULT_FLOW_CACHE_SIZE) == 1, "Flow cache size must be
 static_assert(bitcount32(DEFAULT_FLOW_LINE_SIZE) == 1, "Flow cache line size must be power of two number!");
 static_assert(DEFAULT_FLOW_CACHE_SIZE >= DEFAULT_FLOW_LINE_SIZE, "Flow cache size must be at least cache line size!");
 
+/**
+ * \brief Flow cache implementation.
+ */
+enum cache_type {
+   CACHE_NHT, /**< NHTFlowCache, flow lines with line-local eviction. */
+   CACHE_CUCKOO /**< CuckooFlowCache, bucketized cuckoo hashing with a stash. */
+};
+
+/**
+ * \brief Replacement policy of flow lines.
+ */
+enum cache_replacement {
+   REPLACEMENT_LRU, /**< Move hit records to the front of the flow line. */
+   REPLACEMENT_CLOCK /**< Mark hit records by a reference bit, evict by second chance. */
+};
+
+/**
+ * \brief Parts of the flow key kept by aggregation, the rest of the key is zeroed.
+ */
+struct flow_aggregation {
+   bool enabled;
+   uint8_t src_prefix4; /**< Length of kept source IPv4 prefix. */
+   uint8_t dst_prefix4;
+   uint8_t src_prefix6; /**< Length of kept source IPv6 prefix. */
+   uint8_t dst_prefix6;
+   bool proto;
+   bool src_port;
+   bool dst_port;
+};
+
+/**
+ * \brief How threads wait for work: busy-poll, then yield the CPU, then sleep.
+ */
+struct idle_policy {
+   bool set; /**< Given by user, queues keep their defaults otherwise. */
+   uint32_t spin; /**< Number of busy-polling iterations. */
+   uint32_t yield; /**< Number of CPU yields after busy-polling. */
+};
+
 /**
  * \brief Struct containing module settings.
  */
@@ -96,11 +136,24 @@ struct options_t {
    bool eof;
    bool print_stats;
    bool print_pcap_stats;
+   bool canonical_key;
    uint32_t flow_cache_size;
+   uint32_t flow_cache_max_size;
    uint32_t flow_cache_qsize;
    uint32_t flow_line_size;
    uint32_t input_qsize;
    uint32_t input_pktblock_size;
+   uint32_t storage_threads;
+   uint32_t export_threads;
+   cache_mem_type cache_mem;
+   cache_replacement replacement;
+   cache_type cache;
+   uint32_t cache_ways;
+   uint32_t elephant_table_size;
+   uint32_t sampling_interval;
+   uint32_t sampling_max_interval;
+   flow_aggregation aggregation;
+   idle_policy idle;
    uint32_t snaplen;
    uint32_t fps; // max exported flows per second
    struct timeval inactive_timeout;
@@ -108,6 +161,11 @@ struct options_t {
    struct timeval cache_stats_interval;
    std::vector<std::string> interface;
    std::vector<std::string> pcap_file;
+   std::string snapshot_file; /**< Flow cache snapshot kept across restarts, empty when disabled. */
+   bool snapshot_save; /**< Flows are saved to the snapshot on exit, otherwise only restored. */
+   bool run_to_completion; /**< Input threads process packets in flow cache themselves. */
+   bool cpu_auto; /**< Pin threads to CPUs on NUMA nodes of capture interfaces. */
+   std::vector<int> cpus; /**< CPUs to pin threads to in order of pipelines, empty when not pinning. */
 };
 
 /**
@@ -57,7 +57,10 @@
 #include <iomanip>
 #include <stdlib.h>
 #include <thread>
+#include <algorithm>
+#include <new>
 #include <sys/time.h>
+#include <sched.h>
 
 #ifdef WITH_NEMEA
 #include "fields.h"
@@ -69,6 +72,10 @@
 #include "pcapreader.h"
 #include "ndp.h"
 #include "nhtflowcache.h"
+#include "cuckooflowcache.h"
+#include "cachesnapshot.h"
+#include "flowpool.h"
+#include "affinity.h"
 #include "unirecexporter.h"
 #include "ipfixexporter.h"
 #include "stats.h"
@@ -102,6 +109,8 @@ trap_module_info_t *module_info = NULL;
 #endif
 
 volatile sig_atomic_t stop = 0;
+volatile sig_atomic_t grow_requests = 0;
+volatile sig_atomic_t shrink_requests = 0;
 int terminate_export = 0;
 int terminate_storage = 0;
 int terminate_input = 0;
@@ -126,6 +135,8 @@ int terminate_input = 0;
   PARAM('l', "snapshot_len", "Snapshot length when reading packets. Set value between 120-65535.", required_argument, "uint32") \
   PARAM('t', "timeout", "Active and inactive timeout in seconds. Format: DOUBLE:DOUBLE. Value default means use default value 300.0:30.0.", required_argument, "string") \
   PARAM('s', "cache_size", "Size of flow cache. Parameter is used as an exponent to the power of two. Valid numbers are in range 4-30. default is 17 (131072 records).", required_argument, "string") \
+  PARAM('z', "cache-max-size", "Let flow cache grow up to 2^NUMBER records when it evicts live flows and shrink back to -s size when mostly empty. Signals SIGUSR1 and SIGUSR2 grow and shrink the cache on demand. Default is no resizing.", required_argument, "uint32") \
+  PARAM('k', "canonical-key", "Build direction-agnostic flow keys, so packets of both directions are looked up in the flow cache with a single hash.", no_argument, "none") \
   PARAM('S', "cache-statistics", "Print flow cache statistics. NUMBER specifies interval between prints.", required_argument, "float") \
   PARAM('P', "pcap-statistics", "Print pcap statistics every 5 seconds. The statistics do not behave the same way on all platforms.", no_argument, "none") \
   PARAM('L', "link_bit_field", "Link bit field value.", required_argument, "uint64") \
@@ -135,7 +146,19 @@ int terminate_input = 0;
   PARAM('x', "ipfix", "Export to IPFIX collector. Format: HOST:PORT or [HOST]:PORT", required_argument, "string") \
   PARAM('u', "udp", "Use UDP when exporting to IPFIX collector.", no_argument, "none") \
   PARAM('q', "iqueue", "Input queue size (default 64).", required_argument, "uint32") \
-  PARAM('Q', "oqueue", "Output queue size (default 16536).", required_argument, "uint32") \
+  PARAM('Q', "oqueue", "Size of the export queue of each flow cache (default 16536).", required_argument, "uint32") \
+  PARAM('E', "cache-engine", "Flow cache implementation. ENGINE is nht (default, flow lines), cuckoo (4-way buckets) or cuckoo8 (8-way buckets). Cuckoo cache relocates flows instead of evicting them, so it can be filled over 90 %. Cannot be combined with -R, -y and -z.", required_argument, "string") \
+  PARAM('R', "replacement", "Replacement policy of flow cache lines. POLICY is lru (default, hit records are moved to the front of the line) or clock (hits only set a reference bit, second chance eviction).", required_argument, "string") \
+  PARAM('y', "elephant-table", "Update heavy hitter flows through a direct-mapped table of 2^NUMBER entries (4-16), skipping the flow line lookup and plugins which are done with the flow. Default is off.", required_argument, "uint32") \
+  PARAM('H', "hugepages", "Back flow cache by hugepages. TYPE is one of thp, 2M, 1G or none (default). Explicit hugepages fall back to transparent ones when none are free.", required_argument, "string") \
+  PARAM('g', "aggregate", "Aggregate flows by parts of the flow key, the rest of the key is ignored. Format: comma separated list of src[/V4LEN[/V6LEN]], dst[/V4LEN[/V6LEN]], proto, sport, dport, e.g. src/24/48,dst/24/48,proto,dport.", required_argument, "string") \
+  PARAM('w', "snapshot-file", "Save flows in flow cache to FILE on exit instead of exporting them, restore them from FILE on start. With FILE:restore, flows are only restored. With more flow cache threads, each thread uses FILE.N. Flows with extensions that cannot be saved are exported as usual.", required_argument, "string") \
+  PARAM('a', "sampling", "Process only 1 in N flows chosen by flow hash. With MAX, the interval is doubled up to MAX while storage queues are over 3/4 full and halved back below 1/4. Format: N[:MAX].", required_argument, "string") \
+  PARAM('A', "affinity", "Pin threads to CPUs. CPUS is auto or a list of CPUs and ranges, e.g. 0-3,8. Listed CPUs are taken in order by the input thread and flow cache threads of each input, then by the export threads, threads left without a CPU are not pinned. With auto, each input takes CPUs of the NUMA node of its interface. Packet buffers of an input are allocated on the same node.", required_argument, "string") \
+  PARAM('T', "storage-threads", "Number of flow cache threads per input (default 1). Packets are distributed among them by symmetric flow hash.", required_argument, "uint32") \
+  PARAM('C', "run-to-completion", "Process packets in flow cache right in the thread which reads them, one thread per input with no queue in between. Cannot be combined with -T, sampling interval does not adapt.", no_argument, "none") \
+  PARAM('W', "idle", "Idle policy of threads waiting for work. Format: SPIN[:YIELD]. A thread busy-polls up to SPIN times, then yields the CPU YIELD times and then sleeps. Flow cache and export threads sleep until the producer wakes them up, input threads sleep 1 us between polls. Default is up to 4096 adaptive polls of queues (none on a single CPU), no polling of inputs and no yields.", required_argument, "string") \
+  PARAM('N', "export-threads", "Number of export threads (default 1). Each thread has its own connection to the IPFIX collector, flow cache threads are assigned to export threads in turn and each export thread reads export queues of its flow caches in turn. Flow rate limit (-e) is split among them. Supported with IPFIX export only.", required_argument, "uint32") \
   PARAM('e', "fps", "Export max N flows per second.", required_argument, "uint32") \
   PARAM('m', "mtu", "Max size of IPFIX data packet payload to send.", required_argument, "uint16") \
   PARAM('V', "version", "Print version.", no_argument, "none")\
@@ -305,22 +328,250 @@ int count_trap_interfaces(int argc, char *argv[])
 }
 #endif
 
+#define SAMPLING_ADAPT_PERIOD 100 // Milliseconds between adjustments of adaptive flow sampling
+
+/**
+ * \brief Split of thread time between work and waiting for work.
+ * Time between two marks is accounted to the state the thread was in. Threads mark the end of work
+ * right before a call waiting for more work and the end of waiting right after it, a coarse clock is read.
+ */
+struct ThreadLoad {
+   uint64_t busy; /**< Nanoseconds spent working. */
+   uint64_t idle; /**< Nanoseconds spent waiting for work. */
+   struct timespec last; /**< Time of the last mark. */
+};
+
+/**
+ * \brief Account time since the last mark.
+ * \param [in,out] load Thread load.
+ * \param [in] idle The thread was waiting for work since the last mark.
+ */
+static inline void thread_load_mark(ThreadLoad &load, bool idle)
+{
+   struct timespec now;
+#ifdef __linux__
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+#else
+   clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+   if (load.last.tv_sec || load.last.tv_nsec) {
+      uint64_t time = (now.tv_sec - load.last.tv_sec) * 1000000000 + now.tv_nsec - load.last.tv_nsec;
+      (idle ? load.idle : load.busy) += time;
+   }
+   load.last = now;
+}
+
+/**
+ * \brief Format share of time spent waiting for work.
+ * \param [in] load Thread load.
+ * \return Percentage of idle time.
+ */
+static std::string thread_load_idle(const ThreadLoad &load)
+{
+   if (load.busy + load.idle == 0) {
+      return "-";
+   }
+   char buffer[16];
+   snprintf(buffer, sizeof(buffer), "%.1f%%", 100.0 * load.idle / (load.busy + load.idle));
+   return buffer;
+}
+
 struct InputStats {
    uint64_t packets;
    uint64_t parsed;
    uint64_t bytes;
    uint64_t qtime;
+   uint64_t skipped; /**< Packets of flows left out by sampling. */
    bool error;
    std::string msg;
+   ThreadLoad load;
 };
 
-void input_thread(PacketReceiver *packetloader, PacketBlock *pkts, size_t block_cnt, uint64_t pkt_limit, ipx_ring_t *queue, std::promise<InputStats> *threadOutput)
+/**
+ * \brief Flow sampling state of an input thread.
+ * Adaptive sampling doubles the interval while storage queues back up and halves it when they drain.
+ * Flows are chosen by hash modulo the interval, so flows sampled at an interval are also sampled at
+ * all its divisors and doubling the interval only leaves out a part of the sampled flows. Packets carry
+ * the interval and flow caches export a flow when its packets come with a different one.
+ */
+struct FlowSampler {
+   uint32_t interval; /**< Current interval, 1 keeps all flows. */
+   uint32_t min_interval;
+   uint32_t max_interval;
+   uint32_t queue_size;
+   struct timespec last_adapt;
+};
+
+/**
+ * \brief Compute hash of packet flow which is the same for both directions of the flow.
+ * \param [in] pkt Parsed packet.
+ * \return Hash value.
+ */
+static inline uint32_t symmetric_flow_hash(const Packet &pkt)
+{
+   uint32_t src = pkt.src_ip.v4;
+   uint32_t dst = pkt.dst_ip.v4;
+   if (pkt.ip_version == 6) {
+      const uint32_t *src_v6 = (const uint32_t *) pkt.src_ip.v6;
+      const uint32_t *dst_v6 = (const uint32_t *) pkt.dst_ip.v6;
+      src = src_v6[0] ^ src_v6[1] ^ src_v6[2] ^ src_v6[3];
+      dst = dst_v6[0] ^ dst_v6[1] ^ dst_v6[2] ^ dst_v6[3];
+   }
+
+   /* Mix both endpoints separately and combine them by commutative operation. */
+   uint64_t hash = ((uint64_t) src << 16 | pkt.src_port) * 0x9E3779B97F4A7C15ULL +
+      ((uint64_t) dst << 16 | pkt.dst_port) * 0x9E3779B97F4A7C15ULL + pkt.ip_proto;
+   return (hash ^ (hash >> 32)) * 0x85EBCA6BU;
+}
+
+/**
+ * \brief Decide whether packet belongs to a sampled flow.
+ * \param [in,out] pkt Parsed packet, its sampling interval is set.
+ * \param [in] hash Symmetric flow hash of the packet.
+ * \param [in] interval One of interval flows is sampled.
+ * \return True when packet should be processed.
+ */
+static inline bool sample_pkt(Packet &pkt, uint32_t hash, uint32_t interval)
+{
+   /* Remix the hash, so that the choice does not depend on the shard chosen by the same hash. */
+   hash ^= hash >> 16;
+   hash *= 0x7FEB352DU;
+   hash ^= hash >> 15;
+   hash *= 0x846CA68BU;
+   hash ^= hash >> 16;
+
+   pkt.sampling_interval = interval;
+   return hash % interval == 0;
+}
+
+/**
+ * \brief Adjust adaptive sampling interval to occupancy of storage queues.
+ * \param [in,out] sampler Sampling state.
+ * \param [in] queues Input queues of storage threads.
+ */
+static void adapt_sampling(FlowSampler &sampler, const std::vector<ipx_ring_t *> &queues)
+{
+   struct timespec now;
+#ifdef __linux__
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+#else
+   clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+   if ((now.tv_sec - sampler.last_adapt.tv_sec) * 1000 + (now.tv_nsec - sampler.last_adapt.tv_nsec) / 1000000 < SAMPLING_ADAPT_PERIOD) {
+      return;
+   }
+   sampler.last_adapt = now;
+
+   uint32_t cnt = 0;
+   for (size_t i = 0; i < queues.size(); i++) {
+      uint32_t queue_cnt = ipx_ring_cnt(queues[i]);
+      cnt = queue_cnt > cnt ? queue_cnt : cnt;
+   }
+   if (cnt * 4 > sampler.queue_size * 3 && sampler.interval * 2 <= sampler.max_interval) {
+      sampler.interval *= 2;
+   } else if (cnt * 4 < sampler.queue_size && sampler.interval > sampler.min_interval) {
+      sampler.interval /= 2;
+   }
+}
+
+/**
+ * \brief Drop packets of flows left out by sampling from a block.
+ * \param [in,out] block Packet block, kept packets are moved to its beginning.
+ * \param [in] interval Sampling interval.
+ * \return Number of dropped packets.
+ */
+static size_t sample_block(PacketBlock *block, uint32_t interval)
+{
+   size_t kept = 0;
+   for (size_t j = 0; j < block->cnt; j++) {
+      if (sample_pkt(block->pkts[j], symmetric_flow_hash(block->pkts[j]), interval)) {
+         if (kept != j) {
+            std::swap(block->pkts[kept], block->pkts[j]);
+         }
+         kept++;
+      }
+   }
+   size_t dropped = block->cnt - kept;
+   block->cnt = kept;
+   return dropped;
+}
+
+/**
+ * \brief Wait before polling packet receiver again after a timeout.
+ * Receiver is polled right away for the first idle.spin timeouts in a row, then the CPU is yielded for
+ * idle.yield timeouts and then the thread sleeps between polls.
+ * \param [in] idle Idle policy.
+ * \param [in,out] timeouts Number of timeouts in a row.
+ */
+static inline void input_idle(const idle_policy &idle, uint32_t &timeouts)
+{
+   if (timeouts < idle.spin) {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+   } else if (timeouts - idle.spin < idle.yield) {
+      sched_yield();
+   } else {
+      usleep(1);
+   }
+   if (timeouts < UINT32_MAX) {
+      timeouts++;
+   }
+}
+
+/**
+ * \brief Push packet block to storage queue and measure the time spent waiting for free space.
+ */
+static inline void push_block(ipx_ring_t *queue, PacketBlock *block, InputStats &stats)
 {
    struct timespec start;
    struct timespec end;
+#ifdef __linux__
+   const clockid_t clk_id = CLOCK_MONOTONIC_COARSE;
+#else
+   const clockid_t clk_id = CLOCK_MONOTONIC;
+#endif
+   clock_gettime(clk_id, &start);
+   ipx_ring_push(queue, (void *) block);
+   clock_gettime(clk_id, &end);
+
+   int64_t time = end.tv_nsec - start.tv_nsec;
+   if (start.tv_sec != end.tv_sec) {
+      time += 1000000000;
+   }
+   stats.qtime += time;
+}
+
+/**
+ * \brief Input thread.
+ *
+ * With a single storage queue, packet blocks are handed over to the storage thread as they are read.
+ * With more queues (sharded flow cache), the first block is used for reading and its packets are
+ * distributed into block pools of the shards by symmetric flow hash, so that both directions of a flow
+ * are processed by the same shard. Packet data are not copied, the data buffers are swapped instead.
+ * Packets of flows left out by sampling are dropped before they are queued.
+ *
+ * \param [in] packetloader Packet receiver.
+ * \param [in] pkts Packet blocks of this input.
+ * \param [in] block_cnt Number of packet blocks.
+ * \param [in] pkt_limit Maximum number of packets to read or 0.
+ * \param [in] queues Input queues of storage threads.
+ * \param [in] sampler Flow sampling settings.
+ * \param [in] idle Idle policy.
+ * \param [out] threadOutput Input statistics.
+ */
+void input_thread(PacketReceiver *packetloader, PacketBlock *pkts, size_t block_cnt, uint64_t pkt_limit, std::vector<ipx_ring_t *> queues, FlowSampler sampler, idle_policy idle, std::promise<InputStats> *threadOutput)
+{
    size_t i = 0;
    int ret;
-   InputStats stats = {0, 0, 0, 0, false, ""};
+   InputStats stats = {0, 0, 0, 0, 0, false, "", {0, 0, {0, 0}}};
+   bool sampling = sampler.max_interval > 1;
+   uint32_t timeouts = 0;
+
+   size_t shard_cnt = queues.size();
+   size_t shard_block_cnt = shard_cnt > 1 ? (block_cnt - 1) / shard_cnt : block_cnt;
+   std::vector<size_t> shard_idx(shard_cnt, 0);
+
    while (!terminate_input) {
       PacketBlock *block = &pkts[i];
       block->cnt = 0;
@@ -332,33 +583,72 @@ void input_thread(PacketReceiver *packetloader, PacketBlock *pkts, size_t block_
          }
          block->size = pkt_limit - packetloader->parsed;
       }
+      thread_load_mark(stats.load, false);
       ret = packetloader->get_pkt(*block);
+      /* Receiving packets is work, only time until a timeout is waiting. */
+      thread_load_mark(stats.load, ret == 3);
       if (ret <= 0) {
          stats.error = ret < 0;
          stats.msg = packetloader->error_msg;
          break;
       } else if (ret == 3) { /* Process timeout. */
-         usleep(1);
+         input_idle(idle, timeouts);
+         thread_load_mark(stats.load, true);
          continue;
-      } else if (ret == 2) {
+      }
+      timeouts = 0;
+      if (ret == 2) {
          stats.bytes += block->bytes;
-         #ifdef __linux__
-         const clockid_t clk_id = CLOCK_MONOTONIC_COARSE;
-         #else
-         const clockid_t clk_id = CLOCK_MONOTONIC;
-         #endif
-         clock_gettime(clk_id, &start);
-         ipx_ring_push(queue, (void *) block);
-         clock_gettime(clk_id, &end);
-
-         int64_t time = end.tv_nsec - start.tv_nsec;
-         if (start.tv_sec != end.tv_sec) {
-            time += 1000000000;
+         if (sampling && sampler.max_interval > sampler.min_interval) {
+            adapt_sampling(sampler, queues);
+         }
+         if (shard_cnt == 1) {
+            if (sampling) {
+               stats.skipped += sample_block(block, sampler.interval);
+               if (!block->cnt) {
+                  continue;
+               }
+            }
+            push_block(queues[0], block, stats);
+            i = (i + 1) % block_cnt;
+            continue;
+         }
+
+         for (size_t j = 0; j < block->cnt; j++) {
+            uint32_t hash = symmetric_flow_hash(block->pkts[j]);
+            if (sampling && !sample_pkt(block->pkts[j], hash, sampler.interval)) {
+               stats.skipped++;
+               continue;
+            }
+            size_t s = hash % shard_cnt;
+            PacketBlock *dst = &pkts[1 + s * shard_block_cnt + shard_idx[s]];
+            Packet &src_pkt = block->pkts[j];
+            Packet &dst_pkt = dst->pkts[dst->cnt++];
+
+            /* Hand data buffer over to the shard and keep the free one for reading. */
+            char *buffer = dst_pkt.packet;
+            dst_pkt = src_pkt;
+            src_pkt.packet = buffer;
+
+            if (dst->cnt == dst->size) {
+               push_block(queues[s], dst, stats);
+               shard_idx[s] = (shard_idx[s] + 1) % shard_block_cnt;
+               pkts[1 + s * shard_block_cnt + shard_idx[s]].cnt = 0;
+            }
+         }
+
+         /* Do not hold partially filled blocks back. */
+         for (size_t s = 0; s < shard_cnt; s++) {
+            PacketBlock *dst = &pkts[1 + s * shard_block_cnt + shard_idx[s]];
+            if (dst->cnt) {
+               push_block(queues[s], dst, stats);
+               shard_idx[s] = (shard_idx[s] + 1) % shard_block_cnt;
+               pkts[1 + s * shard_block_cnt + shard_idx[s]].cnt = 0;
+            }
          }
-         stats.qtime += time;
-         i = (i + 1) % block_cnt;
       }
    }
+   thread_load_mark(stats.load, false);
    stats.parsed = packetloader->parsed;
    stats.packets = packetloader->processed;
    threadOutput->set_value(stats);
@@ -366,76 +656,197 @@ void input_thread(PacketReceiver *packetloader, PacketBlock *pkts, size_t block_
 
 struct StorageStats {
    bool error;
+   ThreadLoad load;
 };
 
+/**
+ * \brief Resize flow cache when a resize signal arrived since the last check.
+ * \param [in] cache Flow cache.
+ * \param [in,out] grow_seen Number of handled grow requests.
+ * \param [in,out] shrink_seen Number of handled shrink requests.
+ */
+static inline void handle_resize_requests(FlowCache *cache, sig_atomic_t &grow_seen, sig_atomic_t &shrink_seen)
+{
+   if (grow_seen != grow_requests) {
+      grow_seen = grow_requests;
+      cache->resize(true);
+   }
+   if (shrink_seen != shrink_requests) {
+      shrink_seen = shrink_requests;
+      cache->resize(false);
+   }
+}
+
 void storage_thread(FlowCache *cache, ipx_ring_t *queue, std::promise<StorageStats> *threadOutput)
 {
-   StorageStats stats = {false};
+   StorageStats stats = {false, {0, 0, {0, 0}}};
+   sig_atomic_t grow_seen = 0;
+   sig_atomic_t shrink_seen = 0;
    while (1) {
+      handle_resize_requests(cache, grow_seen, shrink_seen);
+      /* Pop waits for a block according to idle policy of the queue, up to 10 ms. */
+      thread_load_mark(stats.load, false);
       PacketBlock *block = static_cast<PacketBlock *>(ipx_ring_pop(queue));
+      thread_load_mark(stats.load, true);
       if (block) {
-         for (unsigned i = 0; i < block->cnt; i++) {
-            cache->put_pkt(block->pkts[i]);
-         }
+         cache->put_pkts(*block);
       } else if (terminate_storage && !ipx_ring_cnt(queue)) {
          break;
       } else {
          cache->export_expired(time(NULL));
-         usleep(1);
       }
    }
+   thread_load_mark(stats.load, false);
    threadOutput->set_value(stats);
 }
 
+/**
+ * \brief Input thread running flow cache itself (run-to-completion mode).
+ *
+ * Each block is processed by the flow cache right after it is read, while packets are still in CPU cache,
+ * so a single block is used and there is no queue between reading and processing. Sampling interval
+ * stays fixed, there is no queue to adapt it to.
+ *
+ * \param [in] packetloader Packet receiver.
+ * \param [in] block Packet block.
+ * \param [in] cache Flow cache.
+ * \param [in] pkt_limit Maximum number of packets to read or 0.
+ * \param [in] sampler Flow sampling settings.
+ * \param [in] idle Idle policy.
+ * \param [out] inputOutput Input statistics.
+ * \param [out] storageOutput Storage statistics.
+ */
+void fused_thread(PacketReceiver *packetloader, PacketBlock *block, FlowCache *cache, uint64_t pkt_limit, FlowSampler sampler, idle_policy idle, std::promise<InputStats> *inputOutput, std::promise<StorageStats> *storageOutput)
+{
+   int ret;
+   InputStats stats = {0, 0, 0, 0, 0, false, "", {0, 0, {0, 0}}};
+   StorageStats storage_stats = {false, {0, 0, {0, 0}}};
+   sig_atomic_t grow_seen = 0;
+   sig_atomic_t shrink_seen = 0;
+   bool sampling = sampler.interval > 1;
+   uint32_t timeouts = 0;
+
+   while (!terminate_input) {
+      handle_resize_requests(cache, grow_seen, shrink_seen);
+      block->cnt = 0;
+      block->bytes = 0;
+
+      if (pkt_limit && packetloader->parsed + block->size >= pkt_limit) {
+         if (packetloader->parsed >= pkt_limit) {
+            break;
+         }
+         block->size = pkt_limit - packetloader->parsed;
+      }
+      thread_load_mark(stats.load, false);
+      ret = packetloader->get_pkt(*block);
+      thread_load_mark(stats.load, ret == 3);
+      if (ret <= 0) {
+         stats.error = ret < 0;
+         stats.msg = packetloader->error_msg;
+         break;
+      } else if (ret == 3) { /* Process timeout. */
+         cache->export_expired(time(NULL));
+         thread_load_mark(stats.load, false);
+         input_idle(idle, timeouts);
+         thread_load_mark(stats.load, true);
+         continue;
+      }
+      timeouts = 0;
+      if (ret == 2) {
+         stats.bytes += block->bytes;
+         if (sampling) {
+            stats.skipped += sample_block(block, sampler.interval);
+         }
+         if (block->cnt) {
+            cache->put_pkts(*block);
+         }
+      }
+   }
+   thread_load_mark(stats.load, false);
+   stats.parsed = packetloader->parsed;
+   stats.packets = packetloader->processed;
+   storage_stats.load = stats.load;
+   inputOutput->set_value(stats);
+   storageOutput->set_value(storage_stats);
+}
+
 struct OutputStats {
    uint64_t biflows;
    uint64_t bytes;
    uint64_t packets;
    uint64_t dropped;
    bool error;
+   ThreadLoad load;
 };
 
 #define MICRO_SEC 1000000L
+#define EXPORT_BATCH_SIZE 64 // Maximal number of flows popped from export queue and exported at once
 long timeval_diff(const struct timeval *start, const struct timeval *end)
 {
     return (end->tv_sec - start->tv_sec) * MICRO_SEC
         + (end->tv_usec - start->tv_usec);
 }
 
-void export_thread(FlowExporter *exp, ipx_ring_t *queue, std::promise<OutputStats> *threadOutput, uint32_t fps)
+/**
+ * \brief Check whether all export queues are empty.
+ * \param [in] queues Export queues.
+ * \return True when there are no flows to export.
+ */
+bool export_queues_empty(const std::vector<ipx_ring_t *> &queues)
 {
-   OutputStats stats = {0, 0, 0, 0, false};
+   for (unsigned i = 0; i < queues.size(); i++) {
+      if (ipx_ring_cnt(queues[i])) {
+         return false;
+      }
+   }
+   return true;
+}
+
+void export_thread(FlowExporter *exp, std::vector<ipx_ring_t *> queues, std::promise<OutputStats> *threadOutput, uint32_t fps)
+{
+   OutputStats stats = {0, 0, 0, 0, false, {0, 0, {0, 0}}};
    struct timespec sleep_time = {0};
    struct timeval begin;
    struct timeval end;
    struct timeval last_flush;
    uint32_t pkts_from_begin = 0;
    double time_per_pkt = 1000000.0 / fps; // [micro seconds]
+   Flow *flows[EXPORT_BATCH_SIZE];
+   /* Rate limit is kept smooth by not exporting more flows at once than allowed per second. */
+   uint32_t batch_size = fps != 0 && fps < EXPORT_BATCH_SIZE ? fps : EXPORT_BATCH_SIZE;
 
    // Rate limiting algorithm from https://github.com/CESNET/ipfixcol2/blob/master/src/tools/ipfixsend/sender.c#L98
    gettimeofday(&begin, NULL);
    last_flush = begin;
+   uint32_t next_queue = 0;
    while (1) {
+      /* Queues of flow caches are read in turn, a batch from each non-empty queue. */
+      thread_load_mark(stats.load, false);
+      uint32_t cnt = ipx_ring_pop_bulk_any(queues.data(), queues.size(), &next_queue, reinterpret_cast<ipx_msg_t **>(flows), batch_size);
+      thread_load_mark(stats.load, true);
       gettimeofday(&end, NULL);
-
-      Flow *flow = static_cast<Flow *>(ipx_ring_pop(queue));
-      if (!flow) {
+      if (!cnt) {
          if (end.tv_sec - last_flush.tv_sec > 1) {
             last_flush = end;
             exp->flush();
          }
-         if (terminate_export && !ipx_ring_cnt(queue)) {
+         if (terminate_export && export_queues_empty(queues)) {
             break;
          }
          continue;
       }
 
-      stats.biflows++;
-      stats.bytes += flow->src_octet_total_length + flow->dst_octet_total_length;
-      stats.packets += flow->src_pkt_total_cnt + flow->dst_pkt_total_cnt;
-      exp->export_flow(*flow);
+      stats.biflows += cnt;
+      for (uint32_t i = 0; i < cnt; i++) {
+         stats.bytes += flows[i]->src_octet_total_length + flows[i]->dst_octet_total_length;
+         stats.packets += flows[i]->src_pkt_total_cnt + flows[i]->dst_pkt_total_cnt;
+      }
+      exp->export_flows(flows, cnt);
+      for (uint32_t i = 0; i < cnt; i++) {
+         FlowPool::release(flows[i]);
+      }
 
-      pkts_from_begin++;
+      pkts_from_begin += cnt;
       if (fps == 0) {
          // Limit for packets/s is not enabled
          continue;
@@ -458,7 +869,9 @@ void export_thread(FlowExporter *exp, ipx_ring_t *queue, std::promise<OutputStat
       // Sleep
       if (diff > 0) {
          sleep_time.tv_nsec = diff * 1000L;
+         thread_load_mark(stats.load, false);
          nanosleep(&sleep_time, NULL);
+         thread_load_mark(stats.load, true);
       }
 
       if (pkts_from_begin >= fps) {
@@ -467,10 +880,140 @@ void export_thread(FlowExporter *exp, ipx_ring_t *queue, std::promise<OutputStat
          pkts_from_begin = 0;
       }
    }
+   thread_load_mark(stats.load, false);
    stats.dropped = exp->flows_dropped;
    threadOutput->set_value(stats);
 }
 
+/**
+ * \brief Parse flow aggregation settings.
+ * \param [in] settings Comma separated parts of the flow key to keep: src[/V4LEN[/V6LEN]], dst[/V4LEN[/V6LEN]], proto, sport, dport.
+ * \param [out] agg Aggregation settings.
+ * \return True on success.
+ */
+bool parse_aggregation(const string &settings, flow_aggregation &agg)
+{
+   string item;
+   size_t begin = 0, end = 0;
+
+   agg.enabled = true;
+   agg.src_prefix4 = agg.dst_prefix4 = 0;
+   agg.src_prefix6 = agg.dst_prefix6 = 0;
+   agg.proto = agg.src_port = agg.dst_port = false;
+   while (end != string::npos) {
+      end = settings.find(",", begin);
+      item = settings.substr(begin, (end == string::npos ? (settings.length() - begin) : (end - begin)));
+      begin = end + 1;
+
+      if (item == "proto") {
+         agg.proto = true;
+      } else if (item == "sport") {
+         agg.src_port = true;
+      } else if (item == "dport") {
+         agg.dst_port = true;
+      } else if (item.substr(0, item.find("/")) == "src" || item.substr(0, item.find("/")) == "dst") {
+         uint32_t prefix4 = 32;
+         uint32_t prefix6 = 128;
+         size_t slash = item.find("/");
+         if (slash != string::npos) {
+            size_t slash6 = item.find("/", slash + 1);
+            string len4 = item.substr(slash + 1, slash6 == string::npos ? string::npos : slash6 - slash - 1);
+            if (!str_to_uint32(len4, prefix4) || prefix4 > 32 ||
+                (slash6 != string::npos && (!str_to_uint32(item.substr(slash6 + 1), prefix6) || prefix6 > 128))) {
+               return false;
+            }
+         }
+         if (item[0] == 's') {
+            agg.src_prefix4 = prefix4;
+            agg.src_prefix6 = prefix6;
+         } else {
+            agg.dst_prefix4 = prefix4;
+            agg.dst_prefix6 = prefix6;
+         }
+      } else {
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * \brief Create flow cache selected by module options.
+ * \param [in] options Module options.
+ * \param [in] numa_node NUMA node to place cache memory on, -1 for default.
+ * \return New flow cache or NULL when its memory cannot be allocated.
+ */
+FlowCache *create_flow_cache(const options_t &options, int numa_node)
+{
+   try {
+      if (options.cache == CACHE_CUCKOO) {
+         return new CuckooFlowCache(options, numa_node);
+      }
+      return new NHTFlowCache(options, numa_node);
+   } catch (std::bad_alloc &e) {
+      return NULL;
+   }
+}
+
+/**
+ * \brief Packet blocks of one input together with their packets and packet data.
+ */
+struct PacketBuffers {
+   CacheMem mem; /**< Region holding blocks, packets and packet data. */
+   PacketBlock *blocks;
+   Packet *pkts;
+   size_t pkts_cnt;
+};
+
+/**
+ * \brief Allocate packet blocks of one input.
+ * \param [out] buf Allocated buffers.
+ * \param [in] blocks_cnt Number of packet blocks.
+ * \param [in] block_size Number of packets in a block.
+ * \param [in] numa_node NUMA node to place buffers on, -1 for default.
+ * \return True on success.
+ */
+static bool alloc_packet_buffers(PacketBuffers &buf, size_t blocks_cnt, size_t block_size, int numa_node)
+{
+   size_t pkts_offset = (blocks_cnt * sizeof(PacketBlock) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+   size_t data_offset = (pkts_offset + blocks_cnt * block_size * sizeof(Packet) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+
+   buf.pkts_cnt = blocks_cnt * block_size;
+   if (!cache_mem_alloc(buf.mem, data_offset + buf.pkts_cnt * (MAXPCKTSIZE + 1), CACHE_MEM_DEFAULT, numa_node)) {
+      return false;
+   }
+   char *ptr = static_cast<char *>(buf.mem.ptr);
+   buf.blocks = reinterpret_cast<PacketBlock *>(ptr);
+   buf.pkts = reinterpret_cast<Packet *>(ptr + pkts_offset);
+   char *pkt_data = ptr + data_offset;
+
+   for (size_t i = 0; i < blocks_cnt; i++) {
+      buf.blocks[i].pkts = buf.pkts + i * block_size;
+      buf.blocks[i].cnt = 0;
+      buf.blocks[i].size = block_size;
+      for (size_t j = 0; j < block_size; j++) {
+         Packet *pkt = new (&buf.blocks[i].pkts[j]) Packet();
+         pkt->packet = pkt_data + (MAXPCKTSIZE + 1) * (j + i * block_size);
+      }
+   }
+   return true;
+}
+
+/**
+ * \brief Free packet blocks allocated by alloc_packet_buffers.
+ * \param [in,out] buf Buffers to free.
+ */
+static void free_packet_buffers(PacketBuffers &buf)
+{
+   if (buf.mem.ptr == NULL) {
+      return;
+   }
+   for (size_t i = 0; i < buf.pkts_cnt; i++) {
+      buf.pkts[i].~Packet();
+   }
+   cache_mem_free(buf.mem);
+}
+
 /**
  * \brief Convert double to struct timeval.
  * \param [in] value Value to convert.
@@ -505,7 +1048,13 @@ void signal_handler(int sig)
       abort();
    }
 #endif
-   stop = 1;
+   if (sig == SIGUSR1) {
+      grow_requests++;
+   } else if (sig == SIGUSR2) {
+      shrink_requests++;
+   } else {
+      stop = 1;
+   }
 }
 
 #ifndef WITH_NEMEA
@@ -531,45 +1080,92 @@ typedef struct module_param_s {
    if (p_required_argument == required_argument) {module_getopt_string[optidx++] = ':';}
 #endif
 
+struct StorageWorker {
+   FlowCache *plugin;
+   std::thread *thread;
+   std::promise<StorageStats> *promise;
+   std::vector<FlowCachePlugin *> plugins;
+   ipx_ring_t *queue;
+};
+
 struct WorkPipeline {
    struct {
       PacketReceiver *plugin;
       std::thread *thread;
       std::promise<InputStats> *promise;
    } input;
-   struct {
-      FlowCache *plugin;
-      std::thread *thread;
-      std::promise<StorageStats> *promise;
-      std::vector<FlowCachePlugin *> plugins;
-   } storage;
-   ipx_ring_t *queue;
+   std::vector<StorageWorker> storage;
+   PacketBuffers buffers;
 };
 
 struct ExporterWorker {
    FlowExporter *plugin;
    std::thread *thread;
    std::promise<OutputStats> *promise;
-   ipx_ring_t *queue;
+   std::vector<ipx_ring_t *> queues;
 };
 
+/**
+ * \brief Destroy export queues of an exporter.
+ * The first queue holds the shared wake-up data of the group, so it is destroyed last.
+ * \param [in] worker Exporter worker.
+ */
+void destroy_export_queues(ExporterWorker &worker)
+{
+   for (size_t i = worker.queues.size(); i > 0; i--) {
+      ipx_ring_destroy(worker.queues[i - 1]);
+   }
+   worker.queues.clear();
+}
+
+/**
+ * \brief Destroy exporters which have no thread running yet.
+ * \param [in] exporters Exporter workers.
+ */
+void destroy_exporters(std::vector<ExporterWorker> &exporters)
+{
+   for (unsigned i = 0; i < exporters.size(); i++) {
+      delete exporters[i].plugin;
+      destroy_export_queues(exporters[i]);
+   }
+   exporters.clear();
+}
+
 int main(int argc, char *argv[])
 {
    plugins_t plugin_wrapper;
    options_t options;
    options.flow_cache_size = DEFAULT_FLOW_CACHE_SIZE;
+   options.flow_cache_max_size = 0;
    options.flow_line_size = DEFAULT_FLOW_LINE_SIZE;
    double_to_timeval(DEFAULT_INACTIVE_TIMEOUT, options.inactive_timeout);
    double_to_timeval(DEFAULT_ACTIVE_TIMEOUT, options.active_timeout);
    options.print_stats = true; /* Plugins, FlowCache stats ON. */
    options.print_pcap_stats = false;
+   options.canonical_key = false;
    options.basic_ifc_num = 0;
    options.snaplen = 0;
    options.eof = true;
    options.flow_cache_qsize = 16536;
    options.input_qsize = 64;
    options.input_pktblock_size = 32;
+   options.storage_threads = 1;
+   options.cache_mem = CACHE_MEM_DEFAULT;
+   options.replacement = REPLACEMENT_LRU;
+   options.cache = CACHE_NHT;
+   options.cache_ways = 4;
+   options.elephant_table_size = 0;
+   options.sampling_interval = 1;
+   options.sampling_max_interval = 1;
+   options.aggregation.enabled = false;
    options.fps = 0;
+   options.run_to_completion = false;
+   options.export_threads = 1;
+   options.idle.set = false;
+   options.idle.spin = 0;
+   options.idle.yield = 0;
+   options.cpu_auto = false;
+   options.snapshot_save = true;
 
 #ifdef WITH_NEMEA
    bool odid = false;
@@ -579,6 +1175,7 @@ int main(int argc, char *argv[])
 
    bool export_unirec = false;
    bool export_ipfix = false;
+   bool replacement_set = false;
    bool help = false;
    bool udp = false;
    int ifc_cnt = 0;
@@ -772,6 +1369,22 @@ int main(int argc, char *argv[])
             options.flow_cache_size = DEFAULT_FLOW_CACHE_SIZE;
          }
          break;
+      case 'z':
+         {
+            uint32_t tmp;
+            if (!str_to_uint32(optarg, tmp) || tmp <= 3 || tmp > 30) {
+#ifdef WITH_NEMEA
+               FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+               TRAP_DEFAULT_FINALIZATION();
+#endif
+               return error("Invalid argument for option -z");
+            }
+            options.flow_cache_max_size = (1 << tmp);
+         }
+         break;
+      case 'k':
+         options.canonical_key = true;
+         break;
       case 'S':
          {
             double tmp;
@@ -882,6 +1495,157 @@ int main(int argc, char *argv[])
             options.flow_cache_qsize = tmp;
          }
          break;
+      case 'E':
+         if (!strcmp(optarg, "nht")) {
+            options.cache = CACHE_NHT;
+         } else if (!strcmp(optarg, "cuckoo")) {
+            options.cache = CACHE_CUCKOO;
+            options.cache_ways = 4;
+         } else if (!strcmp(optarg, "cuckoo8")) {
+            options.cache = CACHE_CUCKOO;
+            options.cache_ways = 8;
+         } else {
+#ifdef WITH_NEMEA
+            FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+            TRAP_DEFAULT_FINALIZATION();
+#endif
+            return error("Invalid argument for option -E");
+         }
+         break;
+      case 'R':
+         replacement_set = true;
+         if (!strcmp(optarg, "lru")) {
+            options.replacement = REPLACEMENT_LRU;
+         } else if (!strcmp(optarg, "clock")) {
+            options.replacement = REPLACEMENT_CLOCK;
+         } else {
+#ifdef WITH_NEMEA
+            FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+            TRAP_DEFAULT_FINALIZATION();
+#endif
+            return error("Invalid argument for option -R");
+         }
+         break;
+      case 'y':
+         {
+            uint32_t tmp;
+            if (!str_to_uint32(optarg, tmp) || tmp < 4 || tmp > 16) {
+#ifdef WITH_NEMEA
+               FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+               TRAP_DEFAULT_FINALIZATION();
+#endif
+               return error("Invalid argument for option -y");
+            }
+            options.elephant_table_size = (1 << tmp);
+         }
+         break;
+      case 'H':
+         if (!str_to_cache_mem_type(optarg, options.cache_mem)) {
+#ifdef WITH_NEMEA
+            FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+            TRAP_DEFAULT_FINALIZATION();
+#endif
+            return error("Invalid argument for option -H");
+         }
+         break;
+      case 'g':
+         if (!parse_aggregation(optarg, options.aggregation)) {
+#ifdef WITH_NEMEA
+            FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+            TRAP_DEFAULT_FINALIZATION();
+#endif
+            return error("Invalid argument for option -g");
+         }
+         break;
+      case 'w':
+         {
+            /* With the restore suffix, flows are restored and then exported as usual. */
+            char *check = strrchr(optarg, ':');
+            if (check != NULL && !strcmp(check + 1, "restore")) {
+               *check = '\0';
+               options.snapshot_save = false;
+            }
+            options.snapshot_file = optarg;
+         }
+         break;
+      case 'a':
+         {
+            char *check = strchr(optarg, ':');
+            if (check != NULL) {
+               *check = '\0';
+            }
+
+            uint32_t interval;
+            uint32_t max_interval;
+            if (!str_to_uint32(optarg, interval) || interval == 0 ||
+                (check != NULL && (!str_to_uint32(check + 1, max_interval) || max_interval < interval))) {
+#ifdef WITH_NEMEA
+               FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+               TRAP_DEFAULT_FINALIZATION();
+#endif
+               return error("Invalid argument for option -a");
+            }
+            options.sampling_interval = interval;
+            options.sampling_max_interval = check != NULL ? max_interval : interval;
+         }
+         break;
+      case 'C':
+         options.run_to_completion = true;
+         break;
+      case 'W':
+         {
+            char *check = strchr(optarg, ':');
+            if (check != NULL) {
+               *check = '\0';
+            }
+            if (!str_to_uint32(optarg, options.idle.spin) ||
+                (check != NULL && !str_to_uint32(check + 1, options.idle.yield))) {
+#ifdef WITH_NEMEA
+               FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+               TRAP_DEFAULT_FINALIZATION();
+#endif
+               return error("Invalid argument for option -W");
+            }
+            options.idle.set = true;
+         }
+         break;
+      case 'A':
+         if (!strcmp(optarg, "auto")) {
+            options.cpu_auto = true;
+         } else if (!parse_cpu_list(optarg, options.cpus)) {
+#ifdef WITH_NEMEA
+            FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+            TRAP_DEFAULT_FINALIZATION();
+#endif
+            return error("Invalid argument for option -A");
+         }
+         break;
+      case 'T':
+         {
+            uint32_t tmp;
+            if (!str_to_uint32(optarg, tmp) || tmp == 0) {
+#ifdef WITH_NEMEA
+               FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+               TRAP_DEFAULT_FINALIZATION();
+#endif
+               return error("Invalid argument for option -T");
+            }
+            options.storage_threads = tmp;
+         }
+         break;
+      case 'N':
+         {
+            uint32_t tmp;
+            if (!str_to_uint32(optarg, tmp) || tmp == 0) {
+#ifdef WITH_NEMEA
+               FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+               TRAP_DEFAULT_FINALIZATION();
+#endif
+               return error("Invalid argument for option -N");
+            }
+            options.export_threads = tmp;
+         }
+         break;
       case 'e':
             if (!str_to_uint32(optarg, options.fps)) {
 #ifdef WITH_NEMEA
@@ -934,81 +1698,134 @@ int main(int argc, char *argv[])
 #endif
       return error("Specify capture interface (-I) or file for reading (-r). ");
    }
+   if (options.run_to_completion && options.storage_threads > 1) {
+#ifdef WITH_NEMEA
+      TRAP_DEFAULT_FINALIZATION();
+#endif
+      return error("Run-to-completion mode (-C) cannot be combined with more flow cache threads (-T).");
+   }
+   if (options.cache == CACHE_CUCKOO && (options.flow_cache_max_size || options.elephant_table_size || replacement_set)) {
+#ifdef WITH_NEMEA
+      TRAP_DEFAULT_FINALIZATION();
+#endif
+      return error("Cuckoo flow cache (-E) cannot be combined with resizing (-z), heavy hitter table (-y) or replacement policy (-R).");
+   }
+
+   if (options.flow_cache_max_size) {
+      /* Signals request resizing of flow cache, which is possible only up to its maximal size. */
+      signal(SIGUSR1, signal_handler);
+      signal(SIGUSR2, signal_handler);
+   }
 
    if (options.snaplen == 0) { /* Check if user specified snapshot length. */
       options.snaplen = MAXPCKTSIZE;
    }
 
-   FlowExporter *exporter;
-   if (export_unirec) {
+   if (export_unirec && options.export_threads > 1) {
 #ifdef WITH_NEMEA
-      if (options.interface.size()) {
-         for (int i = 0; i < ifc_cnt; i++) {
-            trap_ifcctl(TRAPIFC_OUTPUT, i, TRAPCTL_SETTIMEOUT, TRAP_HALFWAIT);
+      TRAP_DEFAULT_FINALIZATION();
+#endif
+      return error("More export threads (-N) are supported with IPFIX export only.");
+   }
+
+   size_t worker_cnt = options.interface.size() ? options.interface.size() : options.pcap_file.size();
+   /* Every flow cache has its own export queue, so caches do not contend for a shared one.
+    * Flow cache s is exported by export thread s % export_cnt, which reads all its queues. */
+   size_t cache_cnt = worker_cnt * options.storage_threads;
+   size_t export_cnt = std::min<size_t>(options.export_threads, cache_cnt);
+   std::vector<ExporterWorker> exporters;
+   for (unsigned i = 0; i < export_cnt; i++) {
+      ExporterWorker worker = {NULL, NULL, NULL, {}};
+      if (export_unirec) {
+#ifdef WITH_NEMEA
+         if (options.interface.size()) {
+            for (int i = 0; i < ifc_cnt; i++) {
+               trap_ifcctl(TRAPIFC_OUTPUT, i, TRAPCTL_SETTIMEOUT, TRAP_HALFWAIT);
+            }
          }
-      }
-      UnirecExporter *ipxe = new UnirecExporter(options.eof);
-      if (ipxe->init(plugin_wrapper.plugins, ifc_cnt, options.basic_ifc_num, link, dir, odid) != 0) {
-         TRAP_DEFAULT_FINALIZATION();
-         return error("Unable to initialize UnirecExporter.");
-      }
-      exporter = ipxe;
+         UnirecExporter *ipxe = new UnirecExporter(options.eof);
+         if (ipxe->init(plugin_wrapper.plugins, ifc_cnt, options.basic_ifc_num, link, dir, odid) != 0) {
+            TRAP_DEFAULT_FINALIZATION();
+            return error("Unable to initialize UnirecExporter.");
+         }
+         worker.plugin = ipxe;
 #endif
-   } else {
-      IPFIXExporter *ipxe = new IPFIXExporter();
-      if (ipxe->init(plugin_wrapper.plugins, options.basic_ifc_num, link, host, port, udp, mtu, (verbose >= 0), dir) != 0) {
+      } else {
+         /* Each export thread has its own exporter, IPFIX exporters open their own connection. */
+         IPFIXExporter *ipxe = new IPFIXExporter();
+         if (ipxe->init(plugin_wrapper.plugins, options.basic_ifc_num, link, host, port, udp, mtu, (verbose >= 0), dir,
+               options.sampling_max_interval > 1) != 0) {
+            delete ipxe;
+            destroy_exporters(exporters);
 #ifdef WITH_NEMEA
-         TRAP_DEFAULT_FINALIZATION();
+            TRAP_DEFAULT_FINALIZATION();
 #endif
-         return error("Unable to initialize IPFIXExporter.");
+            return error("Unable to initialize IPFIXExporter.");
+         }
+         worker.plugin = ipxe;
       }
-      exporter = ipxe;
-   }
-   ipx_ring_t *export_queue = ipx_ring_init(options.flow_cache_qsize, 1);
-   if (export_queue == NULL) {
-      return error("Unable to initialize ring buffer.");
+      exporters.push_back(worker);
+
+      for (size_t j = i; j < cache_cnt; j += export_cnt) {
+         /* A queue has a single writer, its flow cache. */
+         ipx_ring_t *export_queue = ipx_ring_init(options.flow_cache_qsize, 0);
+         if (export_queue == NULL) {
+            destroy_exporters(exporters);
+#ifdef WITH_NEMEA
+            TRAP_DEFAULT_FINALIZATION();
+#endif
+            return error("Unable to initialize ring buffer.");
+         }
+         if (options.idle.set) {
+            ipx_ring_idle(export_queue, options.idle.spin, options.idle.yield);
+         }
+         exporters[i].queues.push_back(export_queue);
+      }
+      ipx_ring_group(exporters[i].queues.data(), exporters[i].queues.size());
    }
 
    if (!options.print_stats) {
       plugin_wrapper.plugins.push_back(new StatsPlugin(options.cache_stats_interval, cout));
    }
+   if (options.elephant_table_size) {
+      /* Flows skip the flow line lookup only after all plugins are done with them. */
+      for (unsigned i = 0; i < plugin_wrapper.plugins.size(); i++) {
+         if (!plugin_wrapper.plugins[i]->can_finish()) {
+            vector<plugin_opt> &plugin_options = plugin_wrapper.plugins[i]->get_options();
+            cerr << "Warning: elephant table (-y) has no effect with "
+                 << (plugin_options.empty() ? "cache statistics (-S)" : plugin_options[0].ext_name + " plugin")
+                 << ", which needs all packets of a flow" << endl;
+            break;
+         }
+      }
+   }
 
    std::vector<WorkPipeline> pipelines;
-   std::vector<ExporterWorker> exporters;
    std::vector<std::future<InputStats>> inputFutures;
    std::vector<std::future<StorageStats>> storageFutures;
    std::vector<std::future<OutputStats>> outputFutures;
 
-   std::promise<OutputStats> *exporter_stats = new std::promise<OutputStats>();
-   ExporterWorker tmp = {
-      exporter,
-      new std::thread(export_thread, exporter, export_queue, exporter_stats, options.fps),
-      exporter_stats,
-      export_queue
-   };
-   exporters.push_back(tmp);
-   outputFutures.push_back(exporter_stats->get_future());
+   /* Flow rate limit is split among export threads. */
+   uint32_t export_fps = (options.fps + export_cnt - 1) / export_cnt;
+   for (unsigned i = 0; i < exporters.size(); i++) {
+      std::promise<OutputStats> *exporter_stats = new std::promise<OutputStats>();
+      exporters[i].promise = exporter_stats;
+      exporters[i].thread = new std::thread(export_thread, exporters[i].plugin, exporters[i].queues, exporter_stats, export_fps);
+      outputFutures.push_back(exporter_stats->get_future());
+   }
 
-   size_t worker_cnt = options.interface.size() ? options.interface.size() : options.pcap_file.size();
-   size_t blocks_cnt = (options.input_qsize + 1) * worker_cnt;
-   size_t pkts_cnt = blocks_cnt * options.input_pktblock_size;
-   size_t pkt_data_cnt = pkts_cnt * (MAXPCKTSIZE + 1);
+   /* Each storage thread gets its own pool of blocks, sharded inputs need one more block for reading.
+    * In run-to-completion mode, the only block is processed before the next one is read. */
+   size_t worker_blocks_cnt = (options.input_qsize + 1) * options.storage_threads + (options.storage_threads > 1 ? 1 : 0);
+   if (options.run_to_completion) {
+      worker_blocks_cnt = 1;
+   }
    int ret = EXIT_SUCCESS;
    bool print_stats = false;
    bool livecapture = options.interface.size();
-
-   PacketBlock *blocks = new PacketBlock[blocks_cnt];
-   Packet *pkts = new Packet[pkts_cnt];
-   char *pkt_data = new char[pkt_data_cnt];
-
-   for (unsigned i = 0; i < blocks_cnt; i++) {
-      blocks[i].pkts = pkts + i * options.input_pktblock_size;
-      blocks[i].cnt = 0;
-      blocks[i].size = options.input_pktblock_size;
-      for (unsigned j = 0; j < options.input_pktblock_size; j++) {
-         blocks[i].pkts[j].packet = (char *) (pkt_data + (MAXPCKTSIZE + 1) * (j + i * options.input_pktblock_size));
-      }
-   }
+   bool pinning = options.cpu_auto || !options.cpus.empty();
+   std::vector<int> free_cpus = options.cpu_auto ? allowed_cpus() : options.cpus;
+   int export_node = -1;
 
    for (unsigned i = 0; i < worker_cnt; i++) {
 #ifdef HAVE_NDP
@@ -1041,47 +1858,135 @@ int main(int argc, char *argv[])
          }
       }
 
-      FlowCache *flowcache = new NHTFlowCache(options);
-      flowcache->set_queue(export_queue);
-
-      std::vector<FlowCachePlugin *> plugins;
-      for (unsigned int i = 0; i < plugin_wrapper.plugins.size(); i++) {
-         FlowCachePlugin *plugin = plugin_wrapper.plugins[i]->copy();
-         plugins.push_back(plugin);
-         flowcache->add_plugin(plugin);
+      /* Keep threads, packet buffers and flow cache on the NUMA node of the capture device. */
+      int numa_node = options.interface.size() ? ifc_numa_node(options.interface[i]) : -1;
+      int input_cpu = -1;
+      std::vector<int> storage_cpus(options.storage_threads, -1);
+      if (pinning) {
+         int cpu_node = options.cpu_auto ? numa_node : -1;
+         input_cpu = take_cpu(free_cpus, cpu_node);
+         for (unsigned j = 0; j < options.storage_threads && !options.run_to_completion; j++) {
+            storage_cpus[j] = take_cpu(free_cpus, cpu_node);
+         }
+         if (numa_node < 0 && input_cpu >= 0) {
+            numa_node = cpu_numa_node(input_cpu);
+         }
+      }
+      if (i == 0) {
+         export_node = numa_node;
       }
-      flowcache->init();
 
-      ipx_ring_t *input_queue = ipx_ring_init(options.input_qsize, 0);
-      if (export_queue == NULL) {
-         error("Unable to initialize ring buffer.");
+      WorkPipeline pipeline;
+      std::vector<ipx_ring_t *> input_queues;
+      pipeline.input.plugin = packetloader;
+      if (!alloc_packet_buffers(pipeline.buffers, worker_blocks_cnt, options.input_pktblock_size, numa_node)) {
+         error("Unable to allocate packet buffers.");
          delete packetloader;
-         delete flowcache;
          ret = EXIT_FAILURE;
          goto EXIT;
       }
+      for (unsigned j = 0; j < options.storage_threads && !options.run_to_completion; j++) {
+         ipx_ring_t *input_queue = ipx_ring_init(options.input_qsize, 0);
+         if (input_queue == NULL) {
+            error("Unable to initialize ring buffer.");
+            for (unsigned k = 0; k < input_queues.size(); k++) {
+               ipx_ring_destroy(input_queues[k]);
+            }
+            free_packet_buffers(pipeline.buffers);
+            delete packetloader;
+            ret = EXIT_FAILURE;
+            goto EXIT;
+         }
+         if (options.idle.set) {
+            ipx_ring_idle(input_queue, options.idle.spin, options.idle.yield);
+         }
+         input_queues.push_back(input_queue);
+      }
 
-      std::promise<InputStats> *input_stats = new std::promise<InputStats>();
-      std::promise<StorageStats> *storage_stats = new std::promise<StorageStats>();
+      /* All flow caches of the pipeline are allocated before any of its threads starts, so
+       * the pipeline can be released without stopping them. */
+      std::vector<FlowCache *> flowcaches;
+      for (unsigned j = 0; j < options.storage_threads; j++) {
+         FlowCache *flowcache = create_flow_cache(options, numa_node);
+         if (flowcache == NULL) {
+            error("Unable to allocate flow cache memory.");
+            for (unsigned k = 0; k < flowcaches.size(); k++) {
+               delete flowcaches[k];
+            }
+            for (unsigned k = 0; k < input_queues.size(); k++) {
+               ipx_ring_destroy(input_queues[k]);
+            }
+            free_packet_buffers(pipeline.buffers);
+            delete packetloader;
+            ret = EXIT_FAILURE;
+            goto EXIT;
+         }
+         flowcaches.push_back(flowcache);
+      }
 
-      inputFutures.push_back(input_stats->get_future());
-      storageFutures.push_back(storage_stats->get_future());
+      for (unsigned j = 0; j < options.storage_threads; j++) {
+         FlowCache *flowcache = flowcaches[j];
+         /* Flow cache threads are assigned to export threads in turn. */
+         size_t cache_idx = i * options.storage_threads + j;
+         flowcache->set_queue(exporters[cache_idx % export_cnt].queues[cache_idx / export_cnt]);
+         if (!options.snapshot_file.empty()) {
+            /* Flows are distributed among caches the same way after restart, so each cache keeps its own file. */
+            string file = options.snapshot_file;
+            if (worker_cnt * options.storage_threads > 1) {
+               file += "." + to_string(i * options.storage_threads + j);
+            }
+            flowcache->set_snapshot(file, snapshot_config(options, plugin_wrapper.plugins), options.snapshot_save);
+         }
 
-      WorkPipeline tmp = {
-         {
-            packetloader,
-            new std::thread(input_thread, packetloader, &blocks[i * (options.input_qsize + 1)], options.input_qsize + 1, pkt_limit, input_queue, input_stats),
-            input_stats,
-         },
-         {
+         std::vector<FlowCachePlugin *> plugins;
+         for (unsigned int k = 0; k < plugin_wrapper.plugins.size(); k++) {
+            FlowCachePlugin *plugin = plugin_wrapper.plugins[k]->copy();
+            plugins.push_back(plugin);
+            flowcache->add_plugin(plugin);
+         }
+         flowcache->init();
+
+         std::promise<StorageStats> *storage_stats = new std::promise<StorageStats>();
+         storageFutures.push_back(storage_stats->get_future());
+
+         StorageWorker storage = {
             flowcache,
-            new std::thread(storage_thread, flowcache, input_queue, storage_stats),
+            NULL,
             storage_stats,
-            plugins
-         },
-         input_queue
-      };
-      pipelines.push_back(tmp);
+            plugins,
+            NULL
+         };
+         if (!options.run_to_completion) {
+            storage.queue = input_queues[j];
+            storage.thread = new std::thread(storage_thread, flowcache, storage.queue, storage_stats);
+         }
+         if (storage_cpus[j] >= 0 && !pin_thread(*storage.thread, storage_cpus[j])) {
+            cerr << "Warning: unable to pin flow cache thread to CPU " << storage_cpus[j] << endl;
+         }
+         pipeline.storage.push_back(storage);
+      }
+
+      std::promise<InputStats> *input_stats = new std::promise<InputStats>();
+      inputFutures.push_back(input_stats->get_future());
+      FlowSampler sampler = {options.sampling_interval, options.sampling_interval, options.sampling_max_interval, options.input_qsize, {0, 0}};
+      if (options.run_to_completion) {
+         StorageWorker &storage = pipeline.storage[0];
+         pipeline.input.thread = new std::thread(fused_thread, packetloader, pipeline.buffers.blocks, storage.plugin, pkt_limit, sampler, options.idle, input_stats, storage.promise);
+      } else {
+         pipeline.input.thread = new std::thread(input_thread, packetloader, pipeline.buffers.blocks, worker_blocks_cnt, pkt_limit, input_queues, sampler, options.idle, input_stats);
+      }
+      pipeline.input.promise = input_stats;
+      if (input_cpu >= 0 && !pin_thread(*pipeline.input.thread, input_cpu)) {
+         cerr << "Warning: unable to pin input thread to CPU " << input_cpu << endl;
+      }
+      pipelines.push_back(pipeline);
+   }
+
+   for (unsigned i = 0; i < exporters.size() && pinning; i++) {
+      int cpu = take_cpu(free_cpus, options.cpu_auto ? export_node : -1);
+      if (cpu >= 0 && !pin_thread(*exporters[i].thread, cpu)) {
+         cerr << "Warning: unable to pin export thread to CPU " << cpu << endl;
+      }
    }
 
    print_stats = true;
@@ -1119,6 +2024,8 @@ EXIT:
          std::setw(10) << "parsed" <<
          std::setw(16) << "bytes" <<
          std::setw(10) << "qtime" <<
+         std::setw(10) << "skipped" <<
+         std::setw(8)  << "idle" <<
          std::setw(7)  << "status" << std::endl;
 
       for (unsigned i = 0; i < inputFutures.size(); i++) {
@@ -1134,16 +2041,36 @@ EXIT:
             std::setw(9) << input.parsed << " " <<
             std::setw(15) << input.bytes << " " <<
             std::setw(9) << input.qtime << " " <<
+            std::setw(9) << input.skipped << " " <<
+            std::setw(7) << thread_load_idle(input.load) << " " <<
             std::setw(6) << status << std::endl;
       }
    }
 
    terminate_storage = 1;
    for (unsigned i = 0; i < pipelines.size(); i++) {
-      pipelines[i].storage.thread->join();
-      pipelines[i].storage.plugin->finish();
-      for (unsigned j = 0; j < pipelines[i].storage.plugins.size(); j++) {
-         delete pipelines[i].storage.plugins[j];
+      for (unsigned j = 0; j < pipelines[i].storage.size(); j++) {
+         StorageWorker &storage = pipelines[i].storage[j];
+         if (storage.thread != NULL) {
+            storage.thread->join();
+         }
+         storage.plugin->finish();
+         for (unsigned k = 0; k < storage.plugins.size(); k++) {
+            delete storage.plugins[k];
+         }
+      }
+   }
+
+   if (print_stats) {
+      std::cout << "Storage stats:" << std::endl <<
+         std::setw(3) << "#" <<
+         std::setw(8) << "idle" << std::endl;
+
+      for (unsigned i = 0; i < storageFutures.size(); i++) {
+         StorageStats storage = storageFutures[i].get();
+         std::cout <<
+            std::setw(3) << i << " " <<
+            std::setw(7) << thread_load_idle(storage.load) << std::endl;
       }
    }
 
@@ -1153,7 +2080,7 @@ EXIT:
       delete exporters[i].plugin;
       delete exporters[i].thread;
       delete exporters[i].promise;
-      ipx_ring_destroy(exporters[i].queue);
+      destroy_export_queues(exporters[i]);
    }
 
    if (print_stats) {
@@ -1162,7 +2089,8 @@ EXIT:
          std::setw(10) << "biflows" <<
          std::setw(10) << "packets" <<
          std::setw(16) << "bytes" <<
-         std::setw(10) << "dropped" << std::endl;
+         std::setw(10) << "dropped" <<
+         std::setw(8) << "idle" << std::endl;
 
       for (unsigned i = 0; i < outputFutures.size(); i++) {
          OutputStats output = outputFutures[i].get();
@@ -1171,19 +2099,23 @@ EXIT:
             std::setw(9) << output.biflows << " " <<
             std::setw(9) << output.packets << " " <<
             std::setw(15) << output.bytes << " " <<
-            std::setw(9) << output.dropped << std::endl;
+            std::setw(9) << output.dropped << " " <<
+            std::setw(7) << thread_load_idle(output.load) << std::endl;
       }
    }
 
    for (unsigned i = 0; i < pipelines.size(); i++) {
-      delete pipelines[i].storage.plugin;
-      delete pipelines[i].storage.thread;
-      delete pipelines[i].storage.promise;
-      ipx_ring_destroy(pipelines[i].queue);
+      for (unsigned j = 0; j < pipelines[i].storage.size(); j++) {
+         StorageWorker &storage = pipelines[i].storage[j];
+         delete storage.plugin;
+         delete storage.thread;
+         delete storage.promise;
+         if (storage.queue != NULL) {
+            ipx_ring_destroy(storage.queue);
+         }
+      }
+      free_packet_buffers(pipelines[i].buffers);
    }
-   delete [] pkts;
-   delete [] blocks;
-   delete [] pkt_data;
 
 #ifdef WITH_NEMEA
    TRAP_DEFAULT_FINALIZATION();
@@ -52,6 +52,7 @@
 #include "ring.h"
 #include "nhtflowcache.h"
 #include "flowcache.h"
+#include "cachesnapshot.h"
 #include "xxhash.h"
 
 using namespace std;
@@ -68,12 +69,8 @@ inline __attribute__((always_inline)) bool FlowRecord::belongs(uint64_t pkt_hash
 
 void FlowRecord::create(const Packet &pkt, uint64_t pkt_hash)
 {
-   flow.src_pkt_total_cnt = 1;
-
    hash = pkt_hash;
-
-   flow.time_first = pkt.timestamp;
-   flow.time_last = pkt.timestamp;
+   flow.sampling_interval = pkt.sampling_interval;
 
    memcpy(flow.src_mac, pkt.src_mac, 6);
    memcpy(flow.dst_mac, pkt.dst_mac, 6);
@@ -83,67 +80,214 @@ void FlowRecord::create(const Packet &pkt, uint64_t pkt_hash)
       flow.ip_proto = pkt.ip_proto;
       flow.src_ip.v4 = pkt.src_ip.v4;
       flow.dst_ip.v4 = pkt.dst_ip.v4;
-      flow.src_octet_total_length = pkt.ip_length;
    } else if (pkt.ip_version == 6) {
       flow.ip_version = pkt.ip_version;
       flow.ip_proto = pkt.ip_proto;
       memcpy(flow.src_ip.v6, pkt.src_ip.v6, 16);
       memcpy(flow.dst_ip.v6, pkt.dst_ip.v6, 16);
-      flow.src_octet_total_length = pkt.ip_length;
    }
 
-   if (pkt.field_indicator & PCKT_TCP) {
-      flow.src_port = pkt.src_port;
-      flow.dst_port = pkt.dst_port;
-      flow.src_tcp_control_bits = pkt.tcp_control_bits;
-   } else if (pkt.field_indicator & PCKT_UDP) {
-      flow.src_port = pkt.src_port;
-      flow.dst_port = pkt.dst_port;
-   } else if (pkt.field_indicator & PCKT_ICMP) {
+   if (pkt.field_indicator & (PCKT_TCP | PCKT_UDP | PCKT_ICMP)) {
       flow.src_port = pkt.src_port;
       flow.dst_port = pkt.dst_port;
    }
 }
 
-void FlowRecord::update(const Packet &pkt, bool src)
+void FlowState::create(const Packet &pkt, bool pkt_swapped)
 {
-   flow.time_last = pkt.timestamp;
+   swapped = pkt_swapped;
+   time_first = pkt.timestamp;
+   time_last = pkt.timestamp;
+   src_pkt_total_cnt = 1;
+   src_octet_total_length = pkt.ip_length;
+   if (pkt.field_indicator & PCKT_TCP) {
+      src_tcp_control_bits = pkt.tcp_control_bits;
+   }
+}
+
+void FlowState::update(const Packet &pkt, bool src)
+{
+   time_last = pkt.timestamp;
    if (src) {
-      flow.src_pkt_total_cnt++;
-      flow.src_octet_total_length += pkt.ip_length;
+      src_pkt_total_cnt++;
+      src_octet_total_length += pkt.ip_length;
 
       if (pkt.field_indicator & PCKT_TCP) {
-         flow.src_tcp_control_bits |= pkt.tcp_control_bits;
+         src_tcp_control_bits |= pkt.tcp_control_bits;
       }
    } else {
-      flow.dst_pkt_total_cnt++;
-      flow.dst_octet_total_length += pkt.ip_length;
+      dst_pkt_total_cnt++;
+      dst_octet_total_length += pkt.ip_length;
 
       if (pkt.field_indicator & PCKT_TCP) {
-         flow.dst_tcp_control_bits |= pkt.tcp_control_bits;
+         dst_tcp_control_bits |= pkt.tcp_control_bits;
       }
    }
 }
 
+/**
+ * \brief Copy counters into flow which is going to be exported.
+ * \param [out] flow Flow of the record owning this state.
+ */
+void FlowState::store(Flow &flow) const
+{
+   flow.time_first = time_first;
+   flow.time_last = time_last;
+   flow.src_octet_total_length = src_octet_total_length;
+   flow.dst_octet_total_length = dst_octet_total_length;
+   flow.src_pkt_total_cnt = src_pkt_total_cnt;
+   flow.dst_pkt_total_cnt = dst_pkt_total_cnt;
+   flow.src_tcp_control_bits = src_tcp_control_bits;
+   flow.dst_tcp_control_bits = dst_tcp_control_bits;
+}
+
+/**
+ * \brief Set counters from a flow loaded from snapshot.
+ * \param [in] flow Loaded flow.
+ * \param [in] pkt_swapped Endpoints of the flow were swapped when building canonical key.
+ */
+void FlowState::restore(const Flow &flow, bool pkt_swapped)
+{
+   time_first = flow.time_first;
+   time_last = flow.time_last;
+   src_octet_total_length = flow.src_octet_total_length;
+   dst_octet_total_length = flow.dst_octet_total_length;
+   src_pkt_total_cnt = flow.src_pkt_total_cnt;
+   dst_pkt_total_cnt = flow.dst_pkt_total_cnt;
+   src_tcp_control_bits = flow.src_tcp_control_bits;
+   dst_tcp_control_bits = flow.dst_tcp_control_bits;
+   swapped = pkt_swapped;
+}
+
 void NHTFlowCache::init()
 {
    plugins_init();
+   if (!snapshot_file.empty()) {
+      restore_snapshot();
+   }
 }
 
 void NHTFlowCache::export_flow(size_t index)
 {
-   ipx_ring_push(export_queue, &flow_array[index]->flow);
-   std::swap(flow_array[index], flow_array[size + q_index]);
-   flow_array[index]->erase();
-   q_index = (q_index + 1) % q_size;
+   export_record(flow_array[index]);
+   hash_array[index] = 0;
+}
+
+/**
+ * \brief Hand flow of a record over to the exporter and erase the record.
+ * Flow goes out in a flow taken from the pool, so the record can be reused right away.
+ * \param [in] rec Valid flow record.
+ */
+void NHTFlowCache::export_record(FlowRecord *rec)
+{
+   FlowState &state = get_state(rec);
+   timer_cancel(state);
+   state.elephant = false; // Entries of the elephant table no longer match
+   state.store(rec->flow);
+   PooledFlow *exported = pool.get();
+   static_cast<Flow &>(*exported) = rec->flow;
+   rec->flow.exts = NULL;
+   ipx_ring_push(export_queue, exported);
+   used--;
+   rec->erase();
+   state.erase();
+}
+
+/**
+ * \brief Get an erased record, reusing one left over from resizing or constructing a new one.
+ */
+FlowRecord *NHTFlowCache::new_record()
+{
+   if (!free_records.empty()) {
+      FlowRecord *rec = free_records.back();
+      free_records.pop_back();
+      return rec;
+   }
+   /* Records are only constructed when all of them sit in tables, which bounds their number
+    * by the sizes of both tables. */
+   return new (flow_records + records_used++) FlowRecord();
+}
+
+/**
+ * \brief Get record at given flow_array index, constructing a new one if the slot has none yet.
+ * \param [in] index Index to flow_array.
+ * \return Erased or valid flow record.
+ */
+FlowRecord *NHTFlowCache::get_record(size_t index)
+{
+   if (flow_array[index] == NULL) {
+      flow_array[index] = new_record();
+   }
+   return flow_array[index];
+}
+
+/**
+ * \brief Select record to evict from a full flow line by CLOCK (second chance) algorithm.
+ * \param [in] line_index Index of the first slot of the flow line.
+ * \return Index to flow_array.
+ */
+uint32_t NHTFlowCache::clock_victim(uint32_t line_index)
+{
+   uint32_t *hand = clock_hand + line_index / line_size;
+   uint32_t slot = *hand;
+
+   while (ref_array[line_index + slot]) {
+      ref_array[line_index + slot] = 0;
+      slot = (slot + 1) & (line_size - 1);
+   }
+   *hand = (slot + 1) & (line_size - 1);
+   return line_index + slot;
+}
+
+/**
+ * \brief Select record to evict from a full flow line.
+ * Elephants are updated outside of flow lines, so their slot says nothing about their activity.
+ * They are demoted and get a second chance instead, the sketch promotes them again if still heavy.
+ * \param [in] line_index Index of the first slot of the flow line.
+ * \return Index to flow_array.
+ */
+uint32_t NHTFlowCache::evict_victim(uint32_t line_index)
+{
+   uint32_t flow_index = replacement == REPLACEMENT_CLOCK ? clock_victim(line_index) : line_index + line_size - 1;
+
+   while (get_state(flow_array[flow_index]).elephant) {
+      get_state(flow_array[flow_index]).elephant = false;
+#ifdef FLOW_CACHE_STATS
+      elephant_demoted++;
+#endif /* FLOW_CACHE_STATS */
+      if (replacement == REPLACEMENT_CLOCK) {
+         ref_array[flow_index] = 1;
+         flow_index = clock_victim(line_index);
+      } else {
+         FlowRecord *flow = flow_array[flow_index];
+         uint64_t hashval = hash_array[flow_index];
+         for (uint32_t j = flow_index; j > line_index; j--) {
+            flow_array[j] = flow_array[j - 1];
+            hash_array[j] = hash_array[j - 1];
+         }
+         flow_array[line_index] = flow;
+         hash_array[line_index] = hashval;
+      }
+   }
+   return flow_index;
 }
 
 void NHTFlowCache::finish()
 {
    plugins_finish();
 
+   while (old_hash_array != NULL) {
+      migrate_step();
+   }
+
+   if (!snapshot_file.empty() && snapshot_save) {
+      save_snapshot();
+   }
+
+   /* Flows which were not saved are exported. */
    for (unsigned int i = 0; i < size; i++) {
-      if (!flow_array[i]->is_empty()) {
+      if (hash_array[i]) {
+         sync_flow(flow_array[i]);
          plugins_pre_export(flow_array[i]->flow);
          flow_array[i]->flow.end_reason = FLOW_END_FORCED;
          export_flow(i);
@@ -160,40 +304,148 @@ void NHTFlowCache::finish()
 
 void NHTFlowCache::flush(Packet &pkt, size_t flow_index, int ret, bool source_flow)
 {
+   /* Plugins may ask for another flush from post_create, repeat until they are satisfied. */
+   while (true) {
 #ifdef FLOW_CACHE_STATS
-   flushed++;
+      flushed++;
 #endif /* FLOW_CACHE_STATS */
 
-   if (ret == FLOW_FLUSH_WITH_REINSERT) {
+      if (ret != FLOW_FLUSH_WITH_REINSERT) {
+         flow_array[flow_index]->flow.end_reason = FLOW_END_FORCED;
+         export_flow(flow_index);
+         return;
+      }
+
       FlowRecord *flow = flow_array[flow_index];
-      flow_array[size + q_index]->flow =  flow->flow;
-      flow_array[size + q_index]->flow.end_reason = FLOW_END_FORCED;
-      ipx_ring_push(export_queue, &flow_array[size + q_index]->flow);
-      q_index = (q_index + 1) % q_size;
+      FlowState &state = get_state(flow);
+      state.store(flow->flow);
+      PooledFlow *exported = pool.get();
+      static_cast<Flow &>(*exported) = flow->flow;
+      exported->end_reason = FLOW_END_FORCED;
+      ipx_ring_push(export_queue, exported);
       flow->flow.exts = NULL;
 
-      flow->soft_clean(); // Clean counters, set time first to last
-      flow->update(pkt, source_flow); // Set new counters from packet
+      state.soft_clean(); // Clean counters, set time first to last
+      state.update(pkt, source_flow); // Set new counters from packet
+      sync_flow(flow);
       ret = plugins_post_create(flow->flow, pkt);
-      if (ret & FLOW_FLUSH) {
-         flush(pkt, flow_index, ret, source_flow);
+      if (!(ret & FLOW_FLUSH)) {
+         return;
       }
-   } else {
-      flow_array[flow_index]->flow.end_reason = FLOW_END_FORCED;
-      export_flow(flow_index);
    }
 }
 
 int NHTFlowCache::put_pkt(Packet &pkt)
 {
-   int ret = plugins_pre_create(pkt);
+   plugins_pre_create(pkt);
 
    if (!create_hash_key(pkt)) { // saves key value and key length into attributes NHTFlowCache::key and NHTFlowCache::key_len
       return 0;
    }
 
-   uint64_t hashval = XXH64(key, key_len, 0); /* Calculates hash value from key created before. */
+   return process_pkt(pkt, XXH64(key, key_len, 0));
+}
+
+int NHTFlowCache::put_pkts(PacketBlock &block)
+{
+   uint64_t hashes[PUT_PKTS_WINDOW];
+   char keys[PUT_PKTS_WINDOW][FLOW_KEY_SIZE];
+   bool swapped[PUT_PKTS_WINDOW];
+   bool valid[PUT_PKTS_WINDOW];
+
+   for (size_t begin = 0; begin < block.cnt; begin += PUT_PKTS_WINDOW) {
+      Packet *pkts = block.pkts + begin;
+      size_t cnt = block.cnt - begin < PUT_PKTS_WINDOW ? block.cnt - begin : PUT_PKTS_WINDOW;
+
+      /* Compute keys and hashes of the whole window first. */
+      for (size_t i = 0; i < cnt; i++) {
+         plugins_pre_create(pkts[i]);
+         valid[i] = create_hash_key(pkts[i]);
+         if (valid[i]) {
+            hashes[i] = XXH64(key, key_len, 0);
+            memcpy(keys[i], key, FLOW_KEY_SIZE);
+            swapped[i] = key_swapped;
+         }
+      }
+
+      /* Prefetch their flow lines, so that the memory accesses overlap. */
+      for (size_t i = 0; i < cnt; i++) {
+         if (valid[i]) {
+            uint32_t line_index = hashes[i] & line_size_mask;
+            for (uint32_t j = 0; j < line_size; j += CACHE_LINE_SIZE / sizeof(uint64_t)) {
+               __builtin_prefetch(hash_array + line_index + j);
+               __builtin_prefetch(flow_array + line_index + j);
+            }
+         }
+      }
+
+      /* Update flow records. */
+      for (size_t i = 0; i < cnt; i++) {
+         if (valid[i]) {
+            memcpy(key, keys[i], FLOW_KEY_SIZE);
+            key_swapped = swapped[i];
+            process_pkt(pkts[i], hashes[i]);
+         }
+      }
+   }
+   return 0;
+}
+
+/**
+ * \brief Find flow in a flow line.
+ * Hash tag matches are confirmed by comparing the whole flow key, so colliding flows stay apart.
+ * \param [in] line_index Index of the first slot of the flow line.
+ * \param [in] hashval Hash of the flow key.
+ * \param [in] flow_key Flow key zero padded to FLOW_KEY_SIZE.
+ * \return Index to flow_array or line_index + line_size when flow is not in the line.
+ */
+uint32_t NHTFlowCache::find_flow(uint32_t line_index, uint64_t hashval, const char *flow_key)
+{
+   uint32_t i = find_tag(hash_array + line_index, line_size, hashval);
+   while (i < line_size) {
+      if (key_equal(get_key(flow_array[line_index + i]).data, flow_key)) {
+         break;
+      }
+#ifdef FLOW_CACHE_STATS
+      collisions++;
+#endif /* FLOW_CACHE_STATS */
+      i++;
+      i += find_tag(hash_array + line_index + i, line_size - i, hashval);
+   }
+   return line_index + i;
+}
+
+/**
+ * \brief Update flow cache with a packet, its key must be already created.
+ * \param [in] pkt Input parsed packet.
+ * \param [in] hashval Hash of the packet flow key.
+ * \return 0 on success.
+ */
+int NHTFlowCache::process_pkt(Packet &pkt, uint64_t hashval)
+{
+   if (!elephant_table.empty() && update_elephant(pkt, hashval)) {
+      export_expired(pkt.timestamp.tv_sec);
+      return 0;
+   }
+
+   /* Packet is inserted again when its flow had to be exported first, e.g. on SYN after FIN
+    * or on inactive timeout. Key is kept, so pre_create plugins are not called again. */
+   while (!update_flow(pkt, hashval)) {
+   }
 
+   export_expired(pkt.timestamp.tv_sec);
+   return 0;
+}
+
+/**
+ * \brief Find or create flow record of a packet and update it.
+ * \param [in] pkt Input parsed packet.
+ * \param [in] hashval Hash of the packet flow key.
+ * \return False when flow record was exported and packet has to be inserted again.
+ */
+bool NHTFlowCache::update_flow(Packet &pkt, uint64_t hashval)
+{
+   int ret;
    FlowRecord *flow; /* Pointer to flow we will be working with. */
    bool found = false;
    bool source_flow = true;
@@ -201,27 +453,24 @@ int NHTFlowCache::put_pkt(Packet &pkt)
    uint32_t flow_index = 0;
    uint32_t next_line = line_index + line_size;
 
+   /* Flow may still sit in the table being migrated. */
+   migrate_hash(hashval);
+
    /* Find existing flow record in flow cache. */
-   for (flow_index = line_index; flow_index < next_line; flow_index++) {
-      if (flow_array[flow_index]->belongs(hashval)) {
-         found = true;
-         break;
-      }
-   }
+   flow_index = find_flow(line_index, hashval, key);
+   found = flow_index < next_line;
 
-   /* Find inversed flow. */
-   if (!found) {
-      uint64_t hashval_inv = XXH64(key_inv, key_len, 0);
-      uint64_t line_index_inv = hashval_inv & line_size_mask;
-      uint64_t next_line_inv = line_index_inv + line_size;
-      for (flow_index = line_index_inv; flow_index < next_line_inv; flow_index++) {
-         if (flow_array[flow_index]->belongs(hashval_inv)) {
-            found = true;
-            source_flow = false;
-            hashval = hashval_inv;
-            line_index = line_index_inv;
-            break;
-         }
+   /* Find inversed flow. Canonical key is the same for both directions, so there is nothing more to search. */
+   if (!found && !canonical_key) {
+      uint64_t hashval_inv = XXH64(key_inv, fill_aggregated_key(key_inv, pkt, true, aggregation), 0);
+      migrate_hash(hashval_inv);
+      uint32_t line_index_inv = hashval_inv & line_size_mask;
+      flow_index = find_flow(line_index_inv, hashval_inv, key_inv);
+      if (flow_index < line_index_inv + line_size) {
+         found = true;
+         source_flow = false;
+         hashval = hashval_inv;
+         line_index = line_index_inv;
       }
    }
 
@@ -233,65 +482,98 @@ int NHTFlowCache::put_pkt(Packet &pkt)
 #endif /* FLOW_CACHE_STATS */
 
       flow = flow_array[flow_index];
-      for (uint32_t j = flow_index; j > line_index; j--) {
-         flow_array[j] = flow_array[j - 1];
+      if (canonical_key) {
+         source_flow = get_state(flow).is_source(key_swapped);
       }
+      if (replacement == REPLACEMENT_CLOCK) {
+         /* Record stays in its slot, only give it a second chance. */
+         if (!ref_array[flow_index]) {
+            ref_array[flow_index] = 1;
+         }
+      } else {
+         for (uint32_t j = flow_index; j > line_index; j--) {
+            flow_array[j] = flow_array[j - 1];
+            hash_array[j] = hash_array[j - 1];
+         }
 
-      flow_array[line_index] = flow;
-      flow_index = line_index;
+         flow_array[line_index] = flow;
+         hash_array[line_index] = hashval;
+         flow_index = line_index;
+      }
 #ifdef FLOW_CACHE_STATS
       hits++;
 #endif /* FLOW_CACHE_STATS */
    } else {
       /* Existing flow record was not found. Find free place in flow line. */
-      for (flow_index = line_index; flow_index < next_line; flow_index++) {
-         if (flow_array[flow_index]->is_empty()) {
-            found = true;
-            break;
-         }
-      }
+      flow_index = line_index + find_tag(hash_array + line_index, line_size, 0);
+      found = flow_index < next_line;
       if (!found) {
          /* If free place was not found (flow line is full), find
           * record which will be replaced by new record. */
-         flow_index = next_line - 1;
+         flow_index = evict_victim(line_index);
 
          // Export flow
+         sync_flow(flow_array[flow_index]);
          plugins_pre_export(flow_array[flow_index]->flow);
          flow_array[flow_index]->flow.end_reason = FLOW_END_NO_RES;
+#ifdef FLOW_CACHE_STATS
+         const FlowState &victim = get_state(flow_array[flow_index]);
+         evicted_pkts += victim.src_pkt_total_cnt + victim.dst_pkt_total_cnt;
+#endif /* FLOW_CACHE_STATS */
          export_flow(flow_index);
+         period_evicted++;
 
 #ifdef FLOW_CACHE_STATS
          expired++;
 #endif /* FLOW_CACHE_STATS */
-         uint32_t flow_new_index = line_index + line_new_index;
-         flow = flow_array[flow_index];
-         for (uint32_t j = flow_index; j > flow_new_index; j--) {
-            flow_array[j] = flow_array[j - 1];
+         if (replacement != REPLACEMENT_CLOCK) {
+            uint32_t flow_new_index = line_index + line_new_index;
+            flow = flow_array[flow_index];
+            for (uint32_t j = flow_index; j > flow_new_index; j--) {
+               flow_array[j] = flow_array[j - 1];
+               hash_array[j] = hash_array[j - 1];
+            }
+            flow_index = flow_new_index;
+            flow_array[flow_new_index] = flow;
+            hash_array[flow_new_index] = 0;
          }
-         flow_index = flow_new_index;
-         flow_array[flow_new_index] = flow;
 #ifdef FLOW_CACHE_STATS
          not_empty++;
       } else {
          empty++;
 #endif /* FLOW_CACHE_STATS */
       }
+      if (replacement == REPLACEMENT_CLOCK) {
+         /* New flows have to be hit again to get a second chance, so that single packet flows go first. */
+         ref_array[flow_index] = 0;
+      }
    }
 
    pkt.source_pkt = source_flow;
-   flow = flow_array[flow_index];
+   flow = get_record(flow_index);
+   FlowState &state = get_state(flow);
 
-   uint8_t flw_flags = source_flow ? flow->flow.src_tcp_control_bits : flow->flow.dst_tcp_control_bits;
-   if ((pkt.tcp_control_bits & 0x02) && (flw_flags & (0x01 | 0x04))) {
+   uint8_t flw_flags = source_flow ? state.src_tcp_control_bits : state.dst_tcp_control_bits;
+   /* Aggregates hold many connections, so TCP flags never end them. */
+   if ((pkt.tcp_control_bits & 0x02) && (flw_flags & (0x01 | 0x04)) && !aggregation.enabled) {
       // Flows with FIN or RST TCP flags are exported when new SYN packet arrives
       flow_array[flow_index]->flow.end_reason = FLOW_END_EOF;
       export_flow(flow_index);
-      put_pkt(pkt);
-      return 0;
+      return false;
    }
 
-   if (flow->is_empty()) {
+   if (hash_array[flow_index] == 0) {
       flow->create(pkt, hashval);
+      if (aggregation.enabled) {
+         aggregate_flow(flow->flow, aggregation);
+      }
+      state.create(pkt, key_swapped);
+      memcpy(get_key(flow).data, key, FLOW_KEY_SIZE);
+      hash_array[flow_index] = hashval;
+      used++;
+      period_created++;
+      timer_schedule(state, flow_deadline(state));
+      sync_flow(flow);
       ret = plugins_post_create(flow->flow, pkt);
 
       if (ret & FLOW_FLUSH) {
@@ -301,109 +583,519 @@ int NHTFlowCache::put_pkt(Packet &pkt)
 #endif /* FLOW_CACHE_STATS */
       }
    } else {
-      if (pkt.timestamp.tv_sec - flow->flow.time_last.tv_sec >= inactive.tv_sec) {
+      if (pkt.timestamp.tv_sec - state.time_last.tv_sec >= inactive.tv_sec) {
          flow_array[flow_index]->flow.end_reason = FLOW_END_INACTIVE;
+         sync_flow(flow);
          plugins_pre_export(flow->flow);
          export_flow(flow_index);
    #ifdef FLOW_CACHE_STATS
          expired++;
    #endif /* FLOW_CACHE_STATS */
-         return put_pkt(pkt);
+         return false;
+      }
+      if (pkt.sampling_interval != flow->flow.sampling_interval) {
+         /* Adaptive sampling changed the interval, each record covers packets sampled at a single one. */
+         flow->flow.end_reason = FLOW_END_FORCED;
+         sync_flow(flow);
+         plugins_pre_export(flow->flow);
+         export_flow(flow_index);
+#ifdef FLOW_CACHE_STATS
+         flushed++;
+#endif /* FLOW_CACHE_STATS */
+         return false;
       }
       ret = plugins_pre_update(flow->flow, pkt);
       if (ret & FLOW_FLUSH) {
          flush(pkt, flow_index, ret, source_flow);
-         return 0;
+         return true;
       } else {
-         flow->update(pkt, source_flow);
+         state.update(pkt, source_flow);
+         sync_flow(flow);
          ret = plugins_post_update(flow->flow, pkt);
 
          if (ret & FLOW_FLUSH) {
             flush(pkt, flow_index, ret, source_flow);
-            return 0;
+            return true;
          }
       }
 
       /* Check if flow record is expired. */
-      if (pkt.timestamp.tv_sec - flow->flow.time_first.tv_sec >= active.tv_sec) {
+      if (pkt.timestamp.tv_sec - state.time_first.tv_sec >= active.tv_sec) {
          flow_array[flow_index]->flow.end_reason = FLOW_END_ACTIVE;
+         sync_flow(flow);
          plugins_pre_export(flow->flow);
          export_flow(flow_index);
 #ifdef FLOW_CACHE_STATS
          expired++;
 #endif /* FLOW_CACHE_STATS */
+      } else if ((ret & FLOW_PLUGIN_DONE) && !elephant_table.empty()) {
+         detect_elephant(flow, pkt, source_flow);
       }
    }
 
-   export_expired(pkt.timestamp.tv_sec);
-   return 0;
+   return true;
+}
+
+/**
+ * \brief Update flow of a packet through the elephant table.
+ * Only counters are updated. Packets which could end the flow take the regular path.
+ * \param [in,out] pkt Input parsed packet.
+ * \param [in] hashval Hash of the packet flow key.
+ * \return True when the packet was accounted to an elephant.
+ */
+bool NHTFlowCache::update_elephant(Packet &pkt, uint64_t hashval)
+{
+   const ElephantEntry &entry = elephant_table[hashval & elephant_mask];
+   if (entry.hash != hashval) {
+      return false;
+   }
+
+   FlowState &state = flow_states[entry.idx];
+   if (!state.elephant || (pkt.tcp_control_bits & (0x01 | 0x02 | 0x04)) ||
+       pkt.sampling_interval != flow_records[entry.idx].flow.sampling_interval ||
+       pkt.timestamp.tv_sec - state.time_last.tv_sec >= inactive.tv_sec ||
+       pkt.timestamp.tv_sec - state.time_first.tv_sec >= active.tv_sec) {
+      return false;
+   }
+   if (entry.inverse) {
+      fill_aggregated_key(key_inv, pkt, true, aggregation);
+   }
+   if (!key_equal(flow_keys[entry.idx].data, entry.inverse ? key_inv : key)) {
+      return false;
+   }
+
+   bool source_flow = canonical_key ? state.is_source(key_swapped) : !entry.inverse;
+   pkt.source_pkt = source_flow;
+   state.update(pkt, source_flow);
+#ifdef FLOW_CACHE_STATS
+   elephant_hits++;
+#endif /* FLOW_CACHE_STATS */
+   return true;
+}
+
+/**
+ * \brief Count packet of a flow which all plugins are done with, promote the flow to the elephant table when heavy.
+ * \param [in] flow Valid flow record.
+ * \param [in] pkt Input parsed packet.
+ * \param [in] source_flow Packet goes from source to destination of the flow.
+ */
+void NHTFlowCache::detect_elephant(FlowRecord *flow, const Packet &pkt, bool source_flow)
+{
+   uint64_t hashval = flow->get_hash();
+   uint16_t &cnt1 = elephant_sketch[hashval & (ELEPHANT_SKETCH_SIZE - 1)];
+   uint16_t &cnt2 = elephant_sketch[ELEPHANT_SKETCH_SIZE + ((hashval >> 32) & (ELEPHANT_SKETCH_SIZE - 1))];
+   if (cnt1 < UINT16_MAX) {
+      cnt1++;
+   }
+   if (cnt2 < UINT16_MAX) {
+      cnt2++;
+   }
+   if (cnt1 < ELEPHANT_THRESHOLD || cnt2 < ELEPHANT_THRESHOLD) {
+      return;
+   }
+
+   uint32_t idx = flow - flow_records;
+   ElephantEntry &entry = elephant_table[hashval & elephant_mask];
+   entry.hash = hashval;
+   entry.idx = idx;
+   entry.inverse = false;
+   if (!canonical_key) {
+      /* Key of the opposite direction, packets going that way hash differently. */
+      uint64_t hashval_inv = XXH64(key_inv, fill_aggregated_key(key_inv, pkt, source_flow, aggregation), 0);
+      ElephantEntry &entry_inv = elephant_table[hashval_inv & elephant_mask];
+      entry_inv.hash = hashval_inv;
+      entry_inv.idx = idx;
+      entry_inv.inverse = true;
+   }
+#ifdef FLOW_CACHE_STATS
+   if (!flow_states[idx].elephant) {
+      elephant_promoted++;
+   }
+#endif /* FLOW_CACHE_STATS */
+   flow_states[idx].elephant = true;
 }
 
 void NHTFlowCache::export_expired(time_t ts)
 {
-   for (unsigned int i = timeout_idx; i < timeout_idx + line_new_index; i++) {
-      if (!flow_array[i]->is_empty() && ts - flow_array[i]->flow.time_last.tv_sec >= inactive.tv_sec) {
-         flow_array[i]->flow.end_reason = FLOW_END_INACTIVE;
-         plugins_pre_export(flow_array[i]->flow);
-         export_flow(i);
+   if (old_hash_array != NULL) {
+      migrate_step();
+   } else if (max_size > min_size) {
+      check_resize(ts);
+   }
+
+   if (ts <= timer_time) {
+      /* Time went backwards (e.g. idle wall clock followed by pcap timestamps), restart from here. */
+      timer_time = ts;
+      return;
+   }
+
+   /* Age the heavy hitter sketch, so that it follows current rates. */
+   for (size_t i = 0; i < elephant_sketch.size(); i++) {
+      elephant_sketch[i] >>= 1;
+   }
+
+   /* Visit every second elapsed since the last call, at most one whole revolution. */
+   time_t first = ts - timer_time > timer_size ? ts - timer_size + 1 : timer_time + 1;
+   for (time_t t = first; t <= ts; t++) {
+      /* Detach the slot, records which are not expired yet are rescheduled. */
+      timer_batch.swap(timer_wheel[t & timer_mask]);
+      for (size_t i = 0; i < timer_batch.size(); i++) {
+         FlowState &state = flow_states[timer_batch[i].idx];
+         if (state.timer_seq != timer_batch[i].seq) {
+            continue; // Record was exported in the meantime
+         }
+
+         time_t deadline = flow_deadline(state);
+         if (deadline > ts) {
+            timer_schedule(state, deadline);
+            continue;
+         }
+
+         FlowRecord *rec = flow_records + timer_batch[i].idx;
+         migrate_hash(rec->get_hash());
+         if (state.timer_seq != timer_batch[i].seq) {
+            continue; // Record was evicted when its flow line was migrated
+         }
+         if (ts - state.time_last.tv_sec >= inactive.tv_sec) {
+            rec->flow.end_reason = FLOW_END_INACTIVE;
+         } else {
+            rec->flow.end_reason = FLOW_END_ACTIVE;
+         }
+         size_t flow_index = find_flow_index(rec);
+         if (flow_index >= size) {
+            /* Record is not in the table, do not touch the slot of another flow, keep it scheduled for a retry. */
+            timer_schedule(state, ts + 1);
+            continue;
+         }
+         sync_flow(rec);
+         plugins_pre_export(rec->flow);
+         export_flow(flow_index);
 #ifdef FLOW_CACHE_STATS
          expired++;
 #endif /* FLOW_CACHE_STATS */
       }
+      timer_batch.clear();
    }
 
-   timeout_idx = (timeout_idx + line_new_index) & (size - 1);
+   timer_time = ts;
 }
 
-bool NHTFlowCache::create_hash_key(Packet &pkt)
+/**
+ * \brief Find flow cache slot holding given record.
+ * \param [in] rec Flow record stored in the cache.
+ * \return Index to flow_array or size when record is not in its flow line.
+ */
+size_t NHTFlowCache::find_flow_index(const FlowRecord *rec) const
 {
-   if (pkt.ip_version == 4) {
-      struct flow_key_v4_t *key_v4 = (struct flow_key_v4_t *) key;
-      struct flow_key_v4_t *key_v4_inv = (struct flow_key_v4_t *) key_inv;
-
-      key_v4->proto = pkt.ip_proto;
-      key_v4->ip_version = 4;
-      key_v4->src_port = pkt.src_port;
-      key_v4->dst_port = pkt.dst_port;
-      key_v4->src_ip = pkt.src_ip.v4;
-      key_v4->dst_ip = pkt.dst_ip.v4;
-
-      key_v4_inv->proto = pkt.ip_proto;
-      key_v4_inv->ip_version = 4;
-      key_v4_inv->src_port = pkt.dst_port;
-      key_v4_inv->dst_port = pkt.src_port;
-      key_v4_inv->src_ip = pkt.dst_ip.v4;
-      key_v4_inv->dst_ip = pkt.src_ip.v4;
-
-      key_len = sizeof(flow_key_v4_t);
-      return true;
-   } else if (pkt.ip_version == 6) {
-      struct flow_key_v6_t *key_v6 = (struct flow_key_v6_t *) key;
-      struct flow_key_v6_t *key_v6_inv = (struct flow_key_v6_t *) key_inv;
+   uint32_t line_index = rec->get_hash() & line_size_mask;
+   uint32_t next_line = line_index + line_size;
+
+   for (uint32_t flow_index = line_index; flow_index < next_line; flow_index++) {
+      if (flow_array[flow_index] == rec) {
+         return flow_index;
+      }
+   }
+   return size;
+}
+
+/**
+ * \brief Get time when flow record expires on inactive or active timeout.
+ */
+time_t NHTFlowCache::flow_deadline(const FlowState &state) const
+{
+   time_t inactive_deadline = state.time_last.tv_sec + inactive.tv_sec;
+   time_t active_deadline = state.time_first.tv_sec + active.tv_sec;
+   return inactive_deadline < active_deadline ? inactive_deadline : active_deadline;
+}
+
+void NHTFlowCache::timer_schedule(FlowState &state, time_t deadline)
+{
+   TimerEntry entry = {static_cast<uint32_t>(&state - flow_states), ++state.timer_seq};
+   timer_wheel[deadline & timer_mask].push_back(entry);
+}
+
+void NHTFlowCache::timer_cancel(FlowState &state)
+{
+   state.timer_seq++;
+}
+
+/**
+ * \brief Allocate zero filled (empty) table of given size and make it the current one.
+ * \param [in] new_size Number of slots, power of two.
+ * \return True on success.
+ */
+bool NHTFlowCache::alloc_table(uint32_t new_size)
+{
+   size_t ref_offset = (new_size * sizeof(uint64_t) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+   size_t hand_offset = ref_offset + ((new_size * sizeof(uint8_t) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+   size_t array_offset = hand_offset + ((new_size / line_size * sizeof(uint32_t) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+   if (!cache_mem_alloc(table_mem, array_offset + new_size * sizeof(FlowRecord *), mem_type, mem_node)) {
+      return false;
+   }
+
+   size = new_size;
+   /* Mask for getting flow cache line index. */
+   line_size_mask = (size - 1) & ~(line_size - 1);
+   hash_array = static_cast<uint64_t *>(table_mem.ptr);
+   ref_array = static_cast<uint8_t *>(table_mem.ptr) + ref_offset;
+   clock_hand = reinterpret_cast<uint32_t *>(static_cast<char *>(table_mem.ptr) + hand_offset);
+   flow_array = reinterpret_cast<FlowRecord **>(static_cast<char *>(table_mem.ptr) + array_offset);
+   return true;
+}
+
+/**
+ * \brief Replace current table by an empty one of different size.
+ * Records of the old table are moved over incrementally by migrate_step and on lookup.
+ * \param [in] new_size Number of slots of the new table.
+ * \return True when resizing started.
+ */
+bool NHTFlowCache::start_resize(uint32_t new_size)
+{
+   if (old_hash_array != NULL || new_size == size || new_size < min_size || new_size > max_size) {
+      return false;
+   }
+
+   old_mem = table_mem;
+   old_size = size;
+   old_line_size_mask = line_size_mask;
+   old_hash_array = hash_array;
+   old_ref_array = ref_array;
+   old_flow_array = flow_array;
+   if (!alloc_table(new_size)) {
+      table_mem = old_mem;
+      size = old_size;
+      line_size_mask = old_line_size_mask;
+      old_hash_array = NULL;
+      return false;
+   }
+
+   old_migrated.assign(old_size / line_size, 0);
+   migrate_index = 0;
+   resizes++;
+   return true;
+}
 
-      key_v6->proto = pkt.ip_proto;
-      key_v6->ip_version = 6;
-      key_v6->src_port = pkt.src_port;
-      key_v6->dst_port = pkt.dst_port;
-      memcpy(key_v6->src_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
-      memcpy(key_v6->dst_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
+/**
+ * \brief Grow the cache when it evicts live flows, shrink it when it is mostly empty.
+ * \param [in] ts Current time.
+ */
+void NHTFlowCache::check_resize(time_t ts)
+{
+   if (ts < period_start + RESIZE_CHECK_PERIOD && ts >= period_start) {
+      return;
+   }
+
+   if (period_evicted * RESIZE_GROW_RATIO > period_created && size < max_size) {
+      start_resize(size * 2);
+   } else if (used * RESIZE_SHRINK_RATIO < size && size > min_size) {
+      start_resize(size / 2);
+   }
 
-      key_v6_inv->proto = pkt.ip_proto;
-      key_v6_inv->ip_version = 6;
-      key_v6_inv->src_port = pkt.dst_port;
-      key_v6_inv->dst_port = pkt.src_port;
-      memcpy(key_v6_inv->src_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
-      memcpy(key_v6_inv->dst_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
+   period_start = ts;
+   period_created = 0;
+   period_evicted = 0;
+}
 
-      key_len = sizeof(flow_key_v6_t);
-      return true;
+void NHTFlowCache::resize(bool grow)
+{
+   /* Requests are rare, complete a running migration so that this one is not refused. */
+   while (old_hash_array != NULL) {
+      migrate_step();
    }
+   start_resize(grow ? size * 2 : size / 2);
+}
 
-   return false;
+/**
+ * \brief Move valid records of an old flow line into the current table.
+ * Records which do not fit into their new flow line are exported.
+ * \param [in] old_line_index Index of the first slot of the old flow line.
+ */
+void NHTFlowCache::migrate_line(uint32_t old_line_index)
+{
+   old_migrated[old_line_index / line_size] = 1;
+
+   for (uint32_t i = old_line_index; i < old_line_index + line_size; i++) {
+      FlowRecord *rec = old_flow_array[i];
+      if (rec == NULL) {
+         continue;
+      }
+      uint64_t hashval = old_hash_array[i];
+      if (hashval == 0) {
+         free_records.push_back(rec);
+         continue;
+      }
+
+      uint32_t line_index = hashval & line_size_mask;
+      uint32_t flow_index = line_index + find_tag(hash_array + line_index, line_size, 0);
+      if (flow_index >= line_index + line_size) {
+         /* Flow line of the smaller table is full. */
+         sync_flow(rec);
+         plugins_pre_export(rec->flow);
+         rec->flow.end_reason = FLOW_END_NO_RES;
+#ifdef FLOW_CACHE_STATS
+         const FlowState &victim = get_state(rec);
+         evicted_pkts += victim.src_pkt_total_cnt + victim.dst_pkt_total_cnt;
+         not_empty++;
+         expired++;
+#endif /* FLOW_CACHE_STATS */
+         export_record(rec);
+         free_records.push_back(rec);
+         continue;
+      }
+
+      if (flow_array[flow_index] != NULL) {
+         free_records.push_back(flow_array[flow_index]);
+      }
+      flow_array[flow_index] = rec;
+      hash_array[flow_index] = hashval;
+      ref_array[flow_index] = old_ref_array[i];
+   }
+}
+
+/**
+ * \brief Move next few old flow lines to the current table, release the old table when done.
+ */
+void NHTFlowCache::migrate_step()
+{
+   for (uint32_t cnt = 0; cnt < RESIZE_STEP_LINES && migrate_index < old_size; migrate_index += line_size) {
+      if (!old_migrated[migrate_index / line_size]) {
+         migrate_line(migrate_index);
+         cnt++;
+      }
+   }
+
+   if (migrate_index >= old_size) {
+      cache_mem_free(old_mem);
+      old_hash_array = NULL;
+      old_migrated.clear();
+   }
+}
+
+/**
+ * \brief Save flows to the snapshot file and remove them from the cache without exporting them.
+ * Flows with extensions that cannot be saved stay in the cache.
+ */
+void NHTFlowCache::save_snapshot()
+{
+   SnapshotWriter writer;
+   vector<uint32_t> indexes;
+
+   if (!writer.open(snapshot_file, snapshot_cfg)) {
+      cerr << "Warning: flow cache snapshot not saved, " << writer.error_msg << endl;
+      return;
+   }
+   for (uint32_t i = 0; i < size; i++) {
+      if (hash_array[i]) {
+         FlowRecord *rec = flow_array[i];
+         get_state(rec).store(rec->flow);
+         if (writer.save(rec->flow)) {
+            indexes.push_back(i);
+         }
+      }
+   }
+   if (!writer.close()) {
+      cerr << "Warning: flow cache snapshot not saved, " << writer.error_msg << endl;
+      return;
+   }
+
+   for (size_t i = 0; i < indexes.size(); i++) {
+      FlowRecord *rec = flow_array[indexes[i]];
+      FlowState &state = get_state(rec);
+      timer_cancel(state);
+      rec->erase();
+      state.erase();
+      hash_array[indexes[i]] = 0;
+      used--;
+   }
+   saved = indexes.size();
+}
+
+/**
+ * \brief Insert flows saved to the snapshot file by the previous run.
+ * Timeouts continue from saved timestamps, flows which expired meanwhile are exported by the first
+ * call of export_expired.
+ */
+void NHTFlowCache::restore_snapshot()
+{
+   SnapshotReader reader;
+   Flow flow;
+   Packet pkt;
+   extTypeEnum type;
+   const uint8_t *buffer;
+   int len;
+
+   if (!reader.open(snapshot_file, snapshot_cfg)) {
+      if (!reader.error_msg.empty()) {
+         cerr << "Warning: flow cache snapshot not restored, " << reader.error_msg << endl;
+      }
+      return;
+   }
+   while (reader.load(flow)) {
+      bool valid = true;
+      while (valid && reader.load_ext(type, buffer, len)) {
+         RecordExt *ext = plugins_load_ext(type, buffer, len);
+         if (ext != NULL) {
+            flow.addExtension(ext);
+         } else {
+            valid = false;
+         }
+      }
+      fill_key_fields(pkt, flow);
+      if (!valid || !create_hash_key(pkt)) {
+         flow.removeExtensions();
+         continue;
+      }
+
+      uint64_t hashval = XXH64(key, key_len, 0);
+      uint32_t line_index = hashval & line_size_mask;
+      uint32_t flow_index = line_index + find_tag(hash_array + line_index, line_size, 0);
+      if (flow_index >= line_index + line_size) {
+         /* Cache is smaller than the one which saved the snapshot. */
+         flow_index = evict_victim(line_index);
+         sync_flow(flow_array[flow_index]);
+         plugins_pre_export(flow_array[flow_index]->flow);
+         flow_array[flow_index]->flow.end_reason = FLOW_END_NO_RES;
+         export_flow(flow_index);
+      }
+
+      FlowRecord *rec = get_record(flow_index);
+      FlowState &state = get_state(rec);
+      rec->restore(flow, hashval);
+      state.restore(rec->flow, key_swapped);
+      memcpy(get_key(rec).data, key, FLOW_KEY_SIZE);
+      hash_array[flow_index] = hashval;
+      ref_array[flow_index] = 0;
+      used++;
+      restored++;
+      timer_schedule(state, flow_deadline(state));
+   }
+}
+
+bool NHTFlowCache::create_hash_key(const Packet &pkt)
+{
+   key_swapped = canonical_key && canonical_swap(pkt);
+
+   key_len = fill_aggregated_key(key, pkt, key_swapped, aggregation);
+   return key_len != 0;
 }
 
 void NHTFlowCache::print_report()
 {
+   if (max_size > min_size) {
+      cout << "Cache size: " << size << " (resized " << resizes << " times)" << endl;
+   }
+   cout << "Cache memory: " << cache_mem_type_str(table_mem.backing) << ", " << table_mem.size + mem.size << " bytes";
+   /* Node is known only for pages already faulted in. */
+   int node = records_used ? cache_mem_node(flow_records) : -1;
+   if (node >= 0) {
+      cout << ", NUMA node " << node;
+   }
+   cout << endl;
+   cout << "Export pool: " << pool.size() << " flows" << endl;
+   if (!snapshot_file.empty()) {
+      cout << "Snapshot: " << restored << " flows restored, " << saved << " flows saved" << endl;
+   }
+
 #ifdef FLOW_CACHE_STATS
    float tmp = float(lookups) / hits;
 
@@ -414,5 +1106,13 @@ void NHTFlowCache::print_report()
    cout << "Flushed: " << flushed << endl;
    cout << "Average Lookup:  " << tmp << endl;
    cout << "Variance Lookup: " << float(lookups2) / hits - tmp * tmp << endl;
+   cout << "Replacement: " << (replacement == REPLACEMENT_CLOCK ? "clock" : "lru") << endl;
+   cout << "Average evicted flow packets: " << (not_empty ? float(evicted_pkts) / not_empty : 0) << endl;
+   cout << "Hash collisions: " << collisions << endl;
+   if (!elephant_table.empty()) {
+      cout << "Elephant hits: " << elephant_hits << endl;
+      cout << "Elephants promoted: " << elephant_promoted << endl;
+      cout << "Elephants demoted: " << elephant_demoted << endl;
+   }
 #endif /* FLOW_CACHE_STATS */
 }
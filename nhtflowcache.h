@@ -48,17 +48,94 @@
 #define NHTFLOWCACHE_H
 
 #include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <arpa/inet.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "ipfixprobe.h"
 #include "flowcache.h"
 #include "flowifc.h"
 #include "flowexporter.h"
+#include "cachemem.h"
+#include "flowpool.h"
 
 using namespace std;
 
 #define MAX_KEY_LENGTH 38
-#define INACTIVE_CHECK_PERIOD_1 5 // Inactive timeout of flows will be checked every X seconds when packets are continuously arriving
-#define INACTIVE_CHECK_PERIOD_2 1 // Inactive timeout of flows will be checked every X seconds when packet read timeout occured or read is nonblocking
+#define FLOW_KEY_SIZE 40 // MAX_KEY_LENGTH rounded up to whole 8 byte words
+#define CACHE_LINE_SIZE 64
+#define PUT_PKTS_WINDOW 8 // Number of packets whose flow lines are prefetched together
+#define TIMER_WHEEL_MIN_SIZE 16 // Number of one second slots of the timeout wheel, rounded up to power of two
+#define TIMER_WHEEL_MAX_SIZE 4096 // Longer timeouts are handled by rescheduling flows on every revolution
+#define RESIZE_STEP_LINES 4 // Old flow lines moved to the new table with every packet while resizing
+#define RESIZE_CHECK_PERIOD 10 // Seconds between evaluations of automatic resizing
+#define RESIZE_GROW_RATIO 100 // Grow when more than 1/RATIO of created flows evicted a live flow
+#define RESIZE_SHRINK_RATIO 8 // Shrink when less than 1/RATIO of the slots is used
+#define ELEPHANT_SKETCH_SIZE 4096 // Counters in each of the two rows of the heavy hitter sketch
+#define ELEPHANT_THRESHOLD 256 // Sketch count making a flow an elephant, counts are halved every second
+
+/**
+ * \brief Part of flow record updated by every packet, fits into one cache line.
+ * Counters are copied into FlowRecord::flow when the flow is exported and, only for plugins which
+ * read them, before post_create, post_update and pre_export. The split pays off when no plugins are
+ * loaded or none of them reads counters, otherwise every packet touches the cold record as well.
+ * Zero filled state is empty.
+ */
+struct __attribute__((aligned(CACHE_LINE_SIZE))) FlowState {
+   struct timeval time_first;
+   struct timeval time_last;
+   uint64_t src_octet_total_length;
+   uint64_t dst_octet_total_length;
+   uint32_t src_pkt_total_cnt;
+   uint32_t dst_pkt_total_cnt;
+   uint32_t timer_seq; /**< Sequence number of the valid timeout wheel entry of this record. */
+   uint8_t src_tcp_control_bits;
+   uint8_t dst_tcp_control_bits;
+   bool swapped; /**< Endpoints of the first packet were swapped when building canonical key. */
+   bool elephant; /**< Flow is updated through the elephant table. */
+
+   void erase()
+   {
+      /* timer_seq is kept, stale timeout wheel entries must never match again. */
+      memset(&time_first, 0, sizeof(time_first));
+      memset(&time_last, 0, sizeof(time_last));
+      src_octet_total_length = 0;
+      dst_octet_total_length = 0;
+      src_pkt_total_cnt = 0;
+      dst_pkt_total_cnt = 0;
+      src_tcp_control_bits = 0;
+      dst_tcp_control_bits = 0;
+      swapped = false;
+      elephant = false;
+   }
+   void soft_clean()
+   {
+      time_first = time_last;
+      src_pkt_total_cnt = 0;
+      dst_pkt_total_cnt = 0;
+      src_octet_total_length = 0;
+      dst_octet_total_length = 0;
+      src_tcp_control_bits = 0;
+      dst_tcp_control_bits = 0;
+   }
+
+   bool is_source(bool pkt_swapped) const
+   {
+      return pkt_swapped == swapped;
+   }
+   void create(const Packet &pkt, bool pkt_swapped = false);
+   void update(const Packet &pkt, bool src);
+   void store(Flow &flow) const;
+   void restore(const Flow &flow, bool pkt_swapped);
+};
 
 class FlowRecord
 {
@@ -71,31 +148,12 @@ public:
       flow.removeExtensions();
       hash = 0;
 
-      memset(&flow.time_first, 0, sizeof(flow.time_first));
-      memset(&flow.time_last, 0, sizeof(flow.time_last));
       flow.ip_version = 0;
       flow.ip_proto = 0;
       memset(&flow.src_ip, 0, sizeof(flow.src_ip));
       memset(&flow.dst_ip, 0, sizeof(flow.dst_ip));
       flow.src_port = 0;
       flow.dst_port = 0;
-      flow.src_pkt_total_cnt = 0;
-      flow.dst_pkt_total_cnt = 0;
-      flow.src_octet_total_length = 0;
-      flow.dst_octet_total_length = 0;
-      flow.src_tcp_control_bits = 0;
-      flow.dst_tcp_control_bits = 0;
-   }
-   void soft_clean()
-   {
-      flow.removeExtensions();
-      flow.time_first = flow.time_last;
-      flow.src_pkt_total_cnt = 0;
-      flow.dst_pkt_total_cnt = 0;
-      flow.src_octet_total_length = 0;
-      flow.dst_octet_total_length = 0;
-      flow.src_tcp_control_bits = 0;
-      flow.dst_tcp_control_bits = 0;
    }
 
    FlowRecord()
@@ -106,23 +164,79 @@ public:
    {
    };
 
+   uint64_t get_hash() const
+   {
+      return hash;
+   }
+
    inline bool is_empty() const;
    inline bool belongs(uint64_t pkt_hash) const;
    void create(const Packet &pkt, uint64_t pkt_hash);
-   void update(const Packet &pkt, bool src);
+
+   /**
+    * \brief Take over flow loaded from a snapshot, its extensions included.
+    * \param [in,out] saved Loaded flow, left without extensions.
+    * \param [in] flow_hash Hash of the flow key.
+    */
+   void restore(Flow &saved, uint64_t flow_hash)
+   {
+      hash = flow_hash;
+      flow = saved;
+      saved.exts = NULL;
+   }
+};
+
+/**
+ * \brief Flow key of a record zero padded to FLOW_KEY_SIZE, so that keys are always compared whole.
+ * Keys are kept apart from FlowRecord, confirming a hash tag match touches only this array.
+ */
+struct FlowKey {
+   char data[FLOW_KEY_SIZE];
+};
+
+/**
+ * \brief Entry of the elephant table, maps hash of a packet flow key directly to the flow record.
+ */
+struct ElephantEntry {
+   uint64_t hash; /**< Hash of the flow key in the direction of the entry. */
+   uint32_t idx; /**< Index of the flow record. */
+   bool inverse; /**< Entry is for packets going from destination to source of the flow. */
+};
+
+/**
+ * \brief Entry of the timeout wheel.
+ * Entries are never removed from the middle of a slot, cancelled entries are recognized
+ * by sequence number that no longer matches the record.
+ */
+struct TimerEntry {
+   uint32_t idx; /**< Index of the flow record. */
+   uint32_t seq; /**< Value of FlowState::timer_seq when the entry was created. */
 };
 
 class NHTFlowCache : public FlowCache
 {
    bool print_stats;
+   bool canonical_key;
+   flow_aggregation aggregation;
+   cache_replacement replacement;
+   bool key_swapped;
    uint8_t key_len;
    uint32_t size;
+   uint32_t min_size; /**< Cache never shrinks below its initial size. */
+   uint32_t max_size;
    uint32_t line_size;
    uint32_t line_size_mask;
    uint32_t line_new_index;
-   uint32_t q_size;
-   uint32_t q_index;
-   uint32_t timeout_idx;
+   uint32_t timer_size;
+   uint32_t timer_mask;
+   time_t timer_time; /**< Last second processed by the timeout wheel. */
+   uint32_t used; /**< Number of valid flow records in the cache. */
+   uint32_t resizes;
+   time_t period_start; /**< Start of the current automatic resizing period. */
+   uint64_t period_created; /**< Flows created in the current period. */
+   uint64_t period_evicted; /**< Live flows evicted for lack of space in the current period. */
+   uint64_t restored; /**< Flows restored from snapshot. */
+   uint64_t saved; /**< Flows saved to snapshot. */
 #ifdef FLOW_CACHE_STATS
    uint64_t empty;
    uint64_t not_empty;
@@ -131,24 +245,53 @@ class NHTFlowCache : public FlowCache
    uint64_t flushed;
    uint64_t lookups;
    uint64_t lookups2;
+   uint64_t evicted_pkts;
+   uint64_t collisions;
+   uint64_t elephant_hits;
+   uint64_t elephant_promoted;
+   uint64_t elephant_demoted;
 #endif /* FLOW_CACHE_STATS */
    struct timeval active;
    struct timeval inactive;
-   char key[MAX_KEY_LENGTH];
-   char key_inv[MAX_KEY_LENGTH];
+   cache_mem_type mem_type;
+   int mem_node;
+   CacheMem mem; /**< Region holding flow_states, flow_keys and flow_records. */
+   CacheMem table_mem; /**< Region holding hash_array, ref_array, clock_hand and flow_array. */
+   uint32_t records_used; /**< Number of flow_records constructed so far. */
+   char key[FLOW_KEY_SIZE];
+   char key_inv[FLOW_KEY_SIZE];
+   uint64_t *hash_array; /**< Hash tags of records in flow_array, 0 marks an empty slot. */
+   uint8_t *ref_array; /**< Reference bits of flow_array slots used by CLOCK replacement. */
+   uint32_t *clock_hand; /**< Next slot to examine for eviction in every flow line. */
    FlowRecord **flow_array;
+   FlowPool pool; /**< Exported flows until the exporter is done with them. */
    FlowRecord *flow_records;
+   FlowState *flow_states; /**< Hot part of flow_records, indexed the same way. */
+   FlowKey *flow_keys; /**< Keys of flow_records, indexed the same way. */
+   vector<FlowRecord *> free_records; /**< Erased records left in empty slots of resized tables. */
+   vector<TimerEntry> *timer_wheel; /**< Flow records indexed by second of their timeout deadline. */
+   vector<TimerEntry> timer_batch; /**< Entries of the wheel slot being processed. */
+   uint32_t elephant_mask;
+   vector<ElephantEntry> elephant_table; /**< Direct-mapped table of heavy hitters, empty when disabled. */
+   vector<uint16_t> elephant_sketch; /**< Count-min sketch of packets of flows done with plugins. */
+
+   /* Table being migrated to the current one while resizing, old_hash_array is NULL otherwise. */
+   CacheMem old_mem;
+   uint32_t old_size;
+   uint32_t old_line_size_mask;
+   uint64_t *old_hash_array;
+   uint8_t *old_ref_array;
+   FlowRecord **old_flow_array;
+   vector<uint8_t> old_migrated; /**< Flags of old flow lines already moved to the current table. */
+   uint32_t migrate_index; /**< Next old flow line moved by the incremental step. */
 
 public:
-   NHTFlowCache(const options_t &options)
+   NHTFlowCache(const options_t &options, int numa_node = -1) : pool(options.flow_cache_qsize)
    {
       size = options.flow_cache_size;
-      q_size = options.flow_cache_qsize;
-      q_index = 0;
-      timeout_idx = 0;
+      min_size = size;
+      max_size = options.flow_cache_max_size > size ? options.flow_cache_max_size : size;
       line_size = options.flow_line_size;
-      /* Mask for getting flow cache line index. */
-      line_size_mask = (size - 1) & ~(line_size - 1);
       line_new_index = line_size / 2;
 #ifdef FLOW_CACHE_STATS
       empty = 0;
@@ -158,34 +301,145 @@ public:
       flushed = 0;
       lookups = 0;
       lookups2 = 0;
+      evicted_pkts = 0;
+      collisions = 0;
+      elephant_hits = 0;
+      elephant_promoted = 0;
+      elephant_demoted = 0;
 #endif /* FLOW_CACHE_STATS */
       print_stats = options.print_stats;
+      /* Aggregation masks the key in flow direction, so both directions cannot share a canonical key. */
+      canonical_key = options.canonical_key && !options.aggregation.enabled;
+      aggregation = options.aggregation;
+      replacement = options.replacement;
+      key_swapped = false;
       active = options.active_timeout;
       inactive = options.inactive_timeout;
+      mem_type = options.cache_mem;
+      mem_node = numa_node;
+      used = 0;
+      resizes = 0;
+      period_start = 0;
+      period_created = 0;
+      period_evicted = 0;
+      restored = 0;
+      saved = 0;
+      old_hash_array = NULL;
+
+      /* While resizing, both tables can be full, so records are reserved for the largest pair of
+       * sizes. The reserve is not committed, so only records in use take memory. */
+      size_t records_cnt = max_size > size ? max_size + max_size / 2 : size;
+      size_t keys_offset = records_cnt * sizeof(FlowState);
+      size_t records_offset = keys_offset + records_cnt * sizeof(FlowKey);
+      size_t records_mem = records_offset + records_cnt * sizeof(FlowRecord);
+      bool reserved = max_size > size ? cache_mem_reserve(mem, records_mem, mem_type, mem_node) :
+         cache_mem_alloc(mem, records_mem, mem_type, mem_node);
+      if (!reserved || !alloc_table(size)) {
+         cache_mem_free(mem);
+         throw bad_alloc();
+      }
+      flow_states = static_cast<FlowState *>(mem.ptr);
+      flow_keys = reinterpret_cast<FlowKey *>(static_cast<char *>(mem.ptr) + keys_offset);
+      flow_records = reinterpret_cast<FlowRecord *>(static_cast<char *>(mem.ptr) + records_offset);
+      /* Zero filled regions are a valid empty cache: all tags are 0, flow_array holds only NULL
+       * pointers and states are empty. Records are constructed on first use, so pages are faulted
+       * in as traffic arrives. */
+      records_used = 0;
 
-      flow_array = new FlowRecord*[size + q_size];
-      flow_records = new FlowRecord[size + q_size];
-      for (unsigned int i = 0; i < size + q_size; i++) {
-         flow_array[i] = flow_records + i;
+      /* Wheel covers the longest timeout, so flows are usually visited only once they expire. */
+      time_t max_timeout = active.tv_sec > inactive.tv_sec ? active.tv_sec : inactive.tv_sec;
+      timer_size = TIMER_WHEEL_MIN_SIZE;
+      while (timer_size < TIMER_WHEEL_MAX_SIZE && timer_size < max_timeout + 2) {
+         timer_size <<= 1;
+      }
+      timer_mask = timer_size - 1;
+      timer_time = 0;
+      timer_wheel = new vector<TimerEntry>[timer_size];
+
+      /* Elephant table holds a few thousand flows at most, so that it stays in L1/L2 cache. */
+      elephant_mask = options.elephant_table_size ? options.elephant_table_size - 1 : 0;
+      if (options.elephant_table_size) {
+         elephant_table.resize(options.elephant_table_size);
+         elephant_sketch.resize(2 * ELEPHANT_SKETCH_SIZE);
       }
    };
    ~NHTFlowCache()
    {
-      delete [] flow_records;
-      delete [] flow_array;
+      delete [] timer_wheel;
+      for (unsigned int i = 0; i < records_used; i++) {
+         flow_records[i].~FlowRecord();
+      }
+      if (old_hash_array != NULL) {
+         cache_mem_free(old_mem);
+      }
+      cache_mem_free(table_mem);
+      cache_mem_free(mem);
    };
 
 // Put packet into the cache (i.e. update corresponding flow record or create a new one)
    virtual int put_pkt(Packet &pkt);
+   virtual int put_pkts(PacketBlock &block);
    virtual void init();
    virtual void finish();
+   virtual void resize(bool grow);
 
    void export_expired(time_t ts);
    void flush(Packet &pkt, size_t flow_index, int ret, bool source_flow);
 
 protected:
-   bool create_hash_key(Packet &pkt);
+   int process_pkt(Packet &pkt, uint64_t hashval);
+   bool update_flow(Packet &pkt, uint64_t hashval);
+   bool update_elephant(Packet &pkt, uint64_t hashval);
+   void detect_elephant(FlowRecord *flow, const Packet &pkt, bool source_flow);
+   bool create_hash_key(const Packet &pkt);
    void export_flow(size_t index);
+   void export_record(FlowRecord *rec);
+   FlowRecord *new_record();
+   FlowRecord *get_record(size_t index);
+   uint32_t clock_victim(uint32_t line_index);
+   uint32_t evict_victim(uint32_t line_index);
+   FlowState &get_state(const FlowRecord *rec) const
+   {
+      return flow_states[rec - flow_records];
+   }
+   FlowKey &get_key(const FlowRecord *rec) const
+   {
+      return flow_keys[rec - flow_records];
+   }
+   /**
+    * \brief Copy counters of a record into its flow before a hook of plugins which read them.
+    * Otherwise flows are only read on export, which copies the counters itself.
+    */
+   void sync_flow(FlowRecord *rec) const
+   {
+      if (has_counter_readers()) {
+         get_state(rec).store(rec->flow);
+      }
+   }
+   uint32_t find_flow(uint32_t line_index, uint64_t hashval, const char *flow_key);
+   size_t find_flow_index(const FlowRecord *rec) const;
+   time_t flow_deadline(const FlowState &state) const;
+   void timer_schedule(FlowState &state, time_t deadline);
+   void timer_cancel(FlowState &state);
+   bool alloc_table(uint32_t new_size);
+   bool start_resize(uint32_t new_size);
+   void check_resize(time_t ts);
+   void migrate_line(uint32_t old_line_index);
+   void migrate_step();
+   void save_snapshot();
+   void restore_snapshot();
+   /**
+    * \brief Move old flow line which can hold flow with given hash to the current table.
+    */
+   void migrate_hash(uint64_t hashval)
+   {
+      if (old_hash_array != NULL) {
+         uint32_t old_line_index = hashval & old_line_size_mask;
+         if (!old_migrated[old_line_index / line_size]) {
+            migrate_line(old_line_index);
+         }
+      }
+   }
    void print_report();
 };
 
@@ -207,4 +461,233 @@ struct __attribute__((packed)) flow_key_v6_t {
    uint8_t dst_ip[16];
 };
 
+/**
+ * \brief Find hash tag in a flow line or bucket.
+ * \param [in] tags Pointer to the first hash tag of the flow line.
+ * \param [in] cnt Number of hash tags in the flow line.
+ * \param [in] tag Hash tag to search for (0 searches for an empty slot).
+ * \return Offset of the first matching slot or cnt when tag is not present.
+ */
+static inline __attribute__((always_inline)) uint32_t find_tag(const uint64_t *tags, uint32_t cnt, uint64_t tag)
+{
+   uint32_t i = 0;
+#if defined(__AVX2__)
+   const __m256i needle = _mm256_set1_epi64x(tag);
+   for (; i + 4 <= cnt; i += 4) {
+      __m256i cmp = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *) (tags + i)), needle);
+      int mask = _mm256_movemask_pd(_mm256_castsi256_pd(cmp));
+      if (mask) {
+         return i + __builtin_ctz(mask);
+      }
+   }
+#elif defined(__SSE2__)
+   const __m128i needle = _mm_set1_epi64x(tag);
+   for (; i + 2 <= cnt; i += 2) {
+      __m128i cmp = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (tags + i)), needle);
+      /* 64-bit lanes are equal when both of their 32-bit halves are equal. */
+      cmp = _mm_and_si128(cmp, _mm_shuffle_epi32(cmp, _MM_SHUFFLE(2, 3, 0, 1)));
+      int mask = _mm_movemask_pd(_mm_castsi128_pd(cmp));
+      if (mask) {
+         return i + __builtin_ctz(mask);
+      }
+   }
+#endif
+   for (; i < cnt; i++) {
+      if (tags[i] == tag) {
+         return i;
+      }
+   }
+   return cnt;
+}
+
+/**
+ * \brief Compare two zero padded flow keys.
+ * \param [in] a Key of FLOW_KEY_SIZE bytes.
+ * \param [in] b Key of FLOW_KEY_SIZE bytes.
+ * \return True when keys are equal.
+ */
+static inline __attribute__((always_inline)) bool key_equal(const char *a, const char *b)
+{
+   uint64_t tail_a;
+   uint64_t tail_b;
+   memcpy(&tail_a, a + FLOW_KEY_SIZE - sizeof(tail_a), sizeof(tail_a));
+   memcpy(&tail_b, b + FLOW_KEY_SIZE - sizeof(tail_b), sizeof(tail_b));
+#if defined(__AVX2__)
+   __m256i cmp = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) a), _mm256_loadu_si256((const __m256i *) b));
+   return _mm256_movemask_epi8(cmp) == -1 && tail_a == tail_b;
+#elif defined(__SSE2__)
+   __m128i diff = _mm_or_si128(
+      _mm_xor_si128(_mm_loadu_si128((const __m128i *) a), _mm_loadu_si128((const __m128i *) b)),
+      _mm_xor_si128(_mm_loadu_si128((const __m128i *) (a + 16)), _mm_loadu_si128((const __m128i *) (b + 16))));
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xFFFF && tail_a == tail_b;
+#else
+   return memcmp(a, b, FLOW_KEY_SIZE - sizeof(tail_a)) == 0 && tail_a == tail_b;
+#endif
+}
+
+/**
+ * \brief Fill flow key of a packet.
+ * \param [out] buf Buffer for the key, FLOW_KEY_SIZE bytes long. Bytes following the key are zeroed.
+ * \param [in] pkt Parsed packet.
+ * \param [in] swap Swap source and destination endpoints.
+ * \return Length of the key or 0 when packet is neither IPv4 nor IPv6.
+ */
+static inline uint8_t fill_flow_key(char *buf, const Packet &pkt, bool swap)
+{
+   if (pkt.ip_version == 4) {
+      struct flow_key_v4_t *key_v4 = (struct flow_key_v4_t *) buf;
+
+      key_v4->proto = pkt.ip_proto;
+      key_v4->ip_version = 4;
+      if (swap) {
+         key_v4->src_port = pkt.dst_port;
+         key_v4->dst_port = pkt.src_port;
+         key_v4->src_ip = pkt.dst_ip.v4;
+         key_v4->dst_ip = pkt.src_ip.v4;
+      } else {
+         key_v4->src_port = pkt.src_port;
+         key_v4->dst_port = pkt.dst_port;
+         key_v4->src_ip = pkt.src_ip.v4;
+         key_v4->dst_ip = pkt.dst_ip.v4;
+      }
+      memset(buf + sizeof(flow_key_v4_t), 0, FLOW_KEY_SIZE - sizeof(flow_key_v4_t));
+      return sizeof(flow_key_v4_t);
+   } else if (pkt.ip_version == 6) {
+      struct flow_key_v6_t *key_v6 = (struct flow_key_v6_t *) buf;
+
+      key_v6->proto = pkt.ip_proto;
+      key_v6->ip_version = 6;
+      if (swap) {
+         key_v6->src_port = pkt.dst_port;
+         key_v6->dst_port = pkt.src_port;
+         memcpy(key_v6->src_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
+         memcpy(key_v6->dst_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
+      } else {
+         key_v6->src_port = pkt.src_port;
+         key_v6->dst_port = pkt.dst_port;
+         memcpy(key_v6->src_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
+         memcpy(key_v6->dst_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
+      }
+      memset(buf + sizeof(flow_key_v6_t), 0, FLOW_KEY_SIZE - sizeof(flow_key_v6_t));
+      return sizeof(flow_key_v6_t);
+   }
+   return 0;
+}
+
+/**
+ * \brief Keep first bits of an IPv6 address.
+ */
+static inline void mask_ipv6(uint8_t *addr, uint8_t prefix)
+{
+   for (int i = prefix / 8; i < 16; i++) {
+      addr[i] &= i == prefix / 8 ? (uint8_t) (0xFF00 >> (prefix % 8)) : 0;
+   }
+}
+
+/**
+ * \brief Get network mask of an IPv4 prefix.
+ */
+static inline uint32_t mask_ipv4(uint8_t prefix)
+{
+   return prefix ? htonl(0xFFFFFFFFU << (32 - prefix)) : 0;
+}
+
+/**
+ * \brief Fill flow key of a packet reduced to the parts kept by aggregation.
+ * Key is masked after endpoints are swapped, so the key of the opposite direction is masked the same
+ * way as the key of the flow it belongs to. Packets of all flows sharing the kept parts then update
+ * a single aggregate record.
+ * \param [out] buf Buffer for the key, FLOW_KEY_SIZE bytes long.
+ * \param [in] pkt Parsed packet.
+ * \param [in] swap Swap source and destination endpoints.
+ * \param [in] agg Aggregation settings.
+ * \return Length of the key or 0 when packet is neither IPv4 nor IPv6.
+ */
+static inline uint8_t fill_aggregated_key(char *buf, const Packet &pkt, bool swap, const flow_aggregation &agg)
+{
+   uint8_t len = fill_flow_key(buf, pkt, swap);
+   if (!agg.enabled || len == 0) {
+      return len;
+   }
+
+   /* Ports, protocol and IP version are at the same place in both key types. */
+   struct flow_key_v4_t *key_v4 = (struct flow_key_v4_t *) buf;
+   if (pkt.ip_version == 4) {
+      key_v4->src_ip &= mask_ipv4(agg.src_prefix4);
+      key_v4->dst_ip &= mask_ipv4(agg.dst_prefix4);
+   } else {
+      struct flow_key_v6_t *key_v6 = (struct flow_key_v6_t *) buf;
+      mask_ipv6(key_v6->src_ip, agg.src_prefix6);
+      mask_ipv6(key_v6->dst_ip, agg.dst_prefix6);
+   }
+   if (!agg.proto) {
+      key_v4->proto = 0;
+   }
+   if (!agg.src_port) {
+      key_v4->src_port = 0;
+   }
+   if (!agg.dst_port) {
+      key_v4->dst_port = 0;
+   }
+   return len;
+}
+
+/**
+ * \brief Reduce flow key fields of a new flow to the parts kept by aggregation.
+ * \param [in,out] flow Flow created from its first packet.
+ * \param [in] agg Aggregation settings.
+ */
+static inline void aggregate_flow(Flow &flow, const flow_aggregation &agg)
+{
+   if (flow.ip_version == 4) {
+      flow.src_ip.v4 &= mask_ipv4(agg.src_prefix4);
+      flow.dst_ip.v4 &= mask_ipv4(agg.dst_prefix4);
+   } else if (flow.ip_version == 6) {
+      mask_ipv6(flow.src_ip.v6, agg.src_prefix6);
+      mask_ipv6(flow.dst_ip.v6, agg.dst_prefix6);
+   }
+   if (!agg.proto) {
+      flow.ip_proto = 0;
+   }
+   if (!agg.src_port) {
+      flow.src_port = 0;
+   }
+   if (!agg.dst_port) {
+      flow.dst_port = 0;
+   }
+}
+
+/**
+ * \brief Copy flow key fields of a flow into a packet, so that the key of the flow can be built again.
+ * \param [out] pkt Packet to fill.
+ * \param [in] flow Flow stored in the cache.
+ */
+static inline void fill_key_fields(Packet &pkt, const Flow &flow)
+{
+   pkt.ip_version = flow.ip_version;
+   pkt.ip_proto = flow.ip_proto;
+   pkt.src_ip = flow.src_ip;
+   pkt.dst_ip = flow.dst_ip;
+   pkt.src_port = flow.src_port;
+   pkt.dst_port = flow.dst_port;
+}
+
+/**
+ * \brief Decide whether endpoints of a packet have to be swapped to build canonical flow key.
+ * Endpoints are ordered so that both directions of a flow produce the same key.
+ * \param [in] pkt Parsed packet.
+ * \return True when endpoints have to be swapped.
+ */
+static inline bool canonical_swap(const Packet &pkt)
+{
+   if (pkt.ip_version == 4) {
+      return pkt.src_ip.v4 > pkt.dst_ip.v4 ||
+         (pkt.src_ip.v4 == pkt.dst_ip.v4 && pkt.src_port > pkt.dst_port);
+   } else if (pkt.ip_version == 6) {
+      int cmp = memcmp(pkt.src_ip.v6, pkt.dst_ip.v6, sizeof(pkt.src_ip.v6));
+      return cmp > 0 || (cmp == 0 && pkt.src_port > pkt.dst_port);
+   }
+   return false;
+}
+
 #endif
@@ -128,6 +128,23 @@ int NTPPlugin::post_create(Flow &rec, const Packet &pkt)
    return 0;
 }
 
+/**
+ *\brief Called after an existing record is updated.
+ * NTP packets are flushed on creation, so other flows need no more packets.
+ *\param [in,out] rec Reference to flow record.
+ *\param [in] pkt Parsed packet.
+ *\return FLOW_PLUGIN_DONE.
+ */
+int NTPPlugin::post_update(Flow &rec, const Packet &pkt)
+{
+   return FLOW_PLUGIN_DONE;
+}
+
+bool NTPPlugin::can_finish() const
+{
+   return true;
+}
+
 /**
  *\brief Called when everything is processed.
  */
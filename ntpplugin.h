@@ -199,6 +199,8 @@ public:
    NTPPlugin(const options_t &module_options, vector<plugin_opt> plugin_options);
    FlowCachePlugin *copy();
    int post_create(Flow &rec, const Packet &pkt);
+   int post_update(Flow &rec, const Packet &pkt);
+   bool can_finish() const;
    void finish();
    string get_unirec_field_string();
    const char **get_ipfix_string();
@@ -97,11 +97,12 @@ struct Packet : public Record {
    char        *payload; /**< Pointer to packet payload section. */
    bool        source_pkt;
    uint16_t    wirelen; /**< Packet size on wire */
+   uint32_t    sampling_interval; /**< Packet belongs to one of every sampling_interval flows. */
 
    /**
     * \brief Constructor.
     */
-   Packet() : total_length(0), packet(NULL), payload_length(0), payload(NULL)
+   Packet() : total_length(0), packet(NULL), payload_length(0), payload(NULL), sampling_interval(1)
    {
    }
 };
@@ -169,6 +169,19 @@ int PHISTSPlugin::post_update(Flow &rec, const Packet &pkt)
    return 0;
 }
 
+RecordExt *PHISTSPlugin::load_ext(extTypeEnum type, const uint8_t *buffer, int size)
+{
+   if (type != phists) {
+      return NULL;
+   }
+   RecordExtPHISTS *ext = new RecordExtPHISTS();
+   if (!ext->load(buffer, size)) {
+      delete ext;
+      return NULL;
+   }
+   return ext;
+}
+
 const char *ipfix_phists_template[] = {
    IPFIX_PHISTS_TEMPLATE(IPFIX_FIELD_NAMES)
    NULL
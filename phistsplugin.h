@@ -124,6 +124,31 @@ struct RecordExtPHISTS : RecordExt {
 
       return bufferPtr;
    } // fillIPFIX
+
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      uint8_t *ptr = buffer;
+      if (size < (int) (sizeof(size_hist) + sizeof(ipt_hist) + sizeof(last_ts))) {
+         return -1;
+      }
+
+      save_field(ptr, size_hist, sizeof(size_hist));
+      save_field(ptr, ipt_hist, sizeof(ipt_hist));
+      save_field(ptr, last_ts, sizeof(last_ts));
+      return ptr - buffer;
+   }
+
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      if (size != (int) (sizeof(size_hist) + sizeof(ipt_hist) + sizeof(last_ts))) {
+         return false;
+      }
+
+      load_field(buffer, size_hist, sizeof(size_hist));
+      load_field(buffer, ipt_hist, sizeof(ipt_hist));
+      load_field(buffer, last_ts, sizeof(last_ts));
+      return true;
+   }
 };
 
 /**
@@ -137,6 +162,7 @@ public:
    FlowCachePlugin *copy();
    int post_create(Flow &rec, const Packet &pkt);
    int post_update(Flow &rec, const Packet &pkt);
+   RecordExt *load_ext(extTypeEnum type, const uint8_t *buffer, int size);
    const char **get_ipfix_string();
    string get_unirec_field_string();
 
@@ -194,7 +194,26 @@ int PSTATSPlugin::post_update(Flow &rec, const Packet &pkt)
 {
    RecordExtPSTATS *pstats_data = (RecordExtPSTATS *) rec.getExtension(pstats);
    update_record(pstats_data, pkt);
-   return 0;
+   /* Packets beyond the full arrays are not recorded. */
+   return pstats_data->pkt_count >= PSTATS_MAXELEMCOUNT ? FLOW_PLUGIN_DONE : 0;
+}
+
+bool PSTATSPlugin::can_finish() const
+{
+   return true;
+}
+
+RecordExt *PSTATSPlugin::load_ext(extTypeEnum type, const uint8_t *buffer, int size)
+{
+   if (type != pstats) {
+      return NULL;
+   }
+   RecordExtPSTATS *ext = new RecordExtPSTATS();
+   if (!ext->load(buffer, size)) {
+      delete ext;
+      return NULL;
+   }
+   return ext;
 }
 
 const char *ipfix_pstats_template[] = {
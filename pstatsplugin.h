@@ -139,6 +139,49 @@ struct RecordExtPSTATS : RecordExt {
 
       return bufferPtr;
    } // fillIPFIX
+
+   int saved_size() const
+   {
+      return sizeof(pkt_sizes) + sizeof(pkt_tcp_flgs) + sizeof(pkt_timestamps) + sizeof(pkt_dirs) +
+         sizeof(pkt_count) + sizeof(tcp_seq) + sizeof(tcp_ack) + sizeof(tcp_len) + sizeof(tcp_flg);
+   }
+
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      uint8_t *ptr = buffer;
+      if (size < saved_size()) {
+         return -1;
+      }
+
+      save_field(ptr, pkt_sizes, sizeof(pkt_sizes));
+      save_field(ptr, pkt_tcp_flgs, sizeof(pkt_tcp_flgs));
+      save_field(ptr, pkt_timestamps, sizeof(pkt_timestamps));
+      save_field(ptr, pkt_dirs, sizeof(pkt_dirs));
+      save_field(ptr, &pkt_count, sizeof(pkt_count));
+      save_field(ptr, tcp_seq, sizeof(tcp_seq));
+      save_field(ptr, tcp_ack, sizeof(tcp_ack));
+      save_field(ptr, tcp_len, sizeof(tcp_len));
+      save_field(ptr, tcp_flg, sizeof(tcp_flg));
+      return ptr - buffer;
+   }
+
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      if (size != saved_size()) {
+         return false;
+      }
+
+      load_field(buffer, pkt_sizes, sizeof(pkt_sizes));
+      load_field(buffer, pkt_tcp_flgs, sizeof(pkt_tcp_flgs));
+      load_field(buffer, pkt_timestamps, sizeof(pkt_timestamps));
+      load_field(buffer, pkt_dirs, sizeof(pkt_dirs));
+      load_field(buffer, &pkt_count, sizeof(pkt_count));
+      load_field(buffer, tcp_seq, sizeof(tcp_seq));
+      load_field(buffer, tcp_ack, sizeof(tcp_ack));
+      load_field(buffer, tcp_len, sizeof(tcp_len));
+      load_field(buffer, tcp_flg, sizeof(tcp_flg));
+      return pkt_count <= PSTATS_MAXELEMCOUNT;
+   }
 };
 
 /**
@@ -152,7 +195,9 @@ public:
    FlowCachePlugin *copy();
    int post_create(Flow &rec, const Packet &pkt);
    int post_update(Flow &rec, const Packet &pkt);
+   bool can_finish() const;
    void update_record(RecordExtPSTATS *pstats_data, const Packet &pkt);
+   RecordExt *load_ext(extTypeEnum type, const uint8_t *buffer, int size);
    const char **get_ipfix_string();
    string get_unirec_field_string();
 
@@ -40,10 +40,16 @@
  */
 
 #define _ISOC11_SOURCE
+#define _DEFAULT_SOURCE // syscall
 #include <stdlib.h> // aligned_malloc
-//#include <unistd.h>
-#include <pthread.h>
+#include <limits.h>
 #include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #include "ring.h"
 
@@ -67,100 +73,69 @@
 #define __ipx_cache_aligned __ipx_aligned(IPX_CLINE_SIZE)
 // END
 
+/** Default upper limit of busy-wait iterations before a thread goes to sleep */
+#define RING_SPIN_MAX 4096
+/** Lower limit of busy-wait iterations of the adaptive spinning              */
+#define RING_SPIN_MIN 16
+/** Maximal time of a reader sleep on an empty buffer (milliseconds)          */
+#define RING_READER_TIMEOUT 10
+/** Time of a writer sleep on a full buffer before the next check (milliseconds) */
+#define RING_WRITER_TIMEOUT 10
+
 /** Internal identification of the ring buffer */
 static const char *module = "Ring buffer";
 
 /** \brief Data structure for a reader only */
 struct ring_reader {
     /**
-     * \brief Reader head in the buffer (start of the next read operation)
-     * \note Value range [0..size - 1]. Must NOT point behind the end of the buffer.
-     */
-    uint32_t data_idx;
-    /**
-     * \brief Reader head (start of the next read operation)
+     * \brief Reader head (start of the data that still belongs to the reader)
+     * \warning This value is read by writers! Therefore, modification MUST be always atomic.
      * \warning Not limited by the buffer's boundary. Overflow is expected behavior.
      * \note Value range [0..UINT32_MAX].
      */
     uint32_t read_idx;
-    /**
-     * \brief Last known index of writer head (start of the data that still belongs to a writer)
-     * \note In other words, a reader can read up to here (exclusive!).
-     * \note Value range [0..UINT32_MAX].
-     */
-    uint32_t exchange_idx;
-    /**
-     * \brief Reader index of the last sync with a writer (update of the sync structure)
-     * \note Value range [0..UINT32_MAX]. Based on #read_idx.
-     */
-    uint32_t read_commit_idx;
-    /** \brief Total size of the ring buffer (number of pointers)                    */
-    uint32_t size;
-    /**
-     * \brief Size of a synchronization block
-     * \note After writing at least this amount of data, update synchronization structure.
-     */
-    uint32_t div_block;
-
-    /** Previously read messages - only 0 or 1 */
+    /** \brief Number of messages returned by the previous read, released by the next one */
     uint32_t last;
+    /** \brief Current number of busy-wait iterations before sleep */
+    uint32_t spin;
 };
 
 /** \brief Data structure for writers only */
 struct ring_writer {
-    /**
-     * \brief Writer head in the buffer (start of the next write operation)
-     * \note Value range [0..size - 1]. Must NOT point behind the end of the buffer.
-     */
-    uint32_t data_idx;
     /**
      * \brief Writer head (start of the next write operation)
-     * \warning This value can be read by a reader! Therefore, modification MUST be always atomic.
+     * \warning Writers reserve space by moving the head. In multi-writer mode, the head is
+     *   moved by compare-and-swap.
      * \warning Not limited by the buffer's boundary. Overflow is expected behavior.
      * \note Value range [0..UINT32_MAX].
      */
     uint32_t write_idx;
     /**
-     * \brief Last known index of reader head (start of the data that still belongs to a reader)
-     * \note In other words, a writer can write up to here (exclusive!).
-     * \note Value range [0..UINT32_MAX].
-     */
-    uint32_t exchange_idx;
-    /**
-     * \brief Writer index of the last sync with a reader (update of the sync structure)
-     * \note Value range [0..UINT32_MAX]. Based on #write_idx.
+     * \brief Last known index of reader head (a writer can write up to here + size, exclusive!)
+     * \note Only a hint, a writer reloads the reader head when the hint says the buffer is full.
      */
-    uint32_t write_commit_idx;
-    /** \brief Total size of the ring buffer (number of pointers)                    */
-    uint32_t size;
-    /**
-     * \brief Size of a synchronization block
-     * \note After writing at least this amount of data, update synchronization structure.
-     */
-    uint32_t div_block;
+    uint32_t read_idx;
+    /** \brief Current number of busy-wait iterations before sleep */
+    uint32_t spin;
 };
 
-/** \brief Exchange data structure for reader and writers */
+/** \brief Sleep/wake-up data structure for reader and writers */
 struct ring_sync {
+    /** \brief Futex word of a sleeping reader (changed by writers to wake it up)     */
+    uint32_t reader_seq;
     /**
-     * \brief Reader head
-     * \note End of data read by a reader, i.e. a writer can write up to here (exclusive!).
-     * \note Value range [0..UINT32_MAX].
+     * \brief Non-zero when the reader is (going to be) sleeping on an empty buffer
+     * \note Cleared by the writer that wakes the reader up, so the reader is woken up only once.
      */
-    uint32_t           write_idx;
+    uint32_t reader_waiting;
+    /** \brief Futex word of sleeping writers (changed by the reader to wake them up) */
+    uint32_t writer_seq;
     /**
-     * \brief Writer head
-     * \note End of data written by a writer, i.e. a reader can read up to here (exclusive!).
-     * \note Value range [0..UINT32_MAX].
+     * \brief Non-zero when any writer is (going to be) sleeping on a full buffer
+     * \note Cleared by the reader that wakes writers up. A writer that is still out of space
+     *   sets the flag again before it goes back to sleep.
      */
-    uint32_t           read_idx;
-    /** \brief Synchronization mutex (MUST be always used to access data structures here)    */
-    pthread_mutex_t    mutex;
-
-    /** \brief Reader condition variable (empty buffer) */
-    pthread_cond_t     cond_reader;
-    /** \brief Writer condition variable (full buffer)  */
-    pthread_cond_t     cond_writer;
+    uint32_t writer_waiting;
 };
 
 /** \brief Ring buffer */
@@ -169,13 +144,26 @@ struct ipx_ring {
     struct ring_reader reader      __ipx_cache_aligned;
     /** Writers only structure (cache aligned)          */
     struct ring_writer writer      __ipx_cache_aligned;
-    /** Writer lock                                     */
-    pthread_spinlock_t writer_lock __ipx_cache_aligned;
     /** Synchronization structure (cache-aligned)       */
     struct ring_sync   sync        __ipx_cache_aligned;
+    /** Sleep/wake-up data of the reader (own or of the first ring of a group) */
+    struct ring_sync  *reader_sync;
+    /** Total size of the ring buffer (number of pointers) */
+    uint32_t           size;
+    /** Mask of indexes into data (allocated size rounded up to a power of two, minus one) */
+    uint32_t           mask;
+    /** Number of empty fields needed to wake up sleeping writers (avoids waking them per field) */
+    uint32_t           div_block;
+    /** Upper limit of busy-wait iterations (0 = no busy-waiting) */
+    uint32_t           spin_max;
+    /** Number of CPU yields after busy-waiting, before a thread goes to sleep */
+    uint32_t           yields;
     /** Multiple writers mode                           */
     bool               mw_mode;
-    /** Ring data (array of pointers)                   */
+    /**
+     * Ring data (array of pointers)
+     * \note Empty fields are NULL, a reader waits until a writer fills the field.
+     */
     ipx_msg_t        **data;
 };
 
@@ -184,6 +172,11 @@ ipx_ring_init(uint32_t size, bool mw_mode)
 {
     ipx_ring_t *ring;
 
+    if (size == 0 || size > (UINT32_MAX >> 1) + 1) {
+        IPX_ERROR(module, "invalid size of a ring buffer (%" PRIu32 ")", size);
+        return NULL;
+    }
+
     // Prepare data structures
     ring = aligned_alloc(alignof(struct ipx_ring), sizeof(struct ipx_ring));
     if (!ring) {
@@ -191,271 +184,474 @@ ipx_ring_init(uint32_t size, bool mw_mode)
         return NULL;
     }
 
-    ring->data = aligned_alloc(alignof(*ring->data), sizeof(*ring->data) * size);
+    // Indexes into data are masked instead of divided by the size
+    uint32_t alloc_size = 1;
+    while (alloc_size < size) {
+        alloc_size <<= 1;
+    }
+    size_t data_size = sizeof(*ring->data) * alloc_size;
+    data_size = (data_size + IPX_CLINE_SIZE - 1) & ~((size_t) IPX_CLINE_SIZE - 1);
+    ring->data = aligned_alloc(IPX_CLINE_SIZE, data_size);
     if (!ring->data) {
         IPX_ERROR(module, "aligned_alloc() failed! (%s:%d)", __FILE__, __LINE__);
-        goto exit_A;
-    }
-
-    // Initialize writers' spin lock
-    int rc;
-    if ((rc = pthread_spin_init(&ring->writer_lock, PTHREAD_PROCESS_PRIVATE)) != 0) {
-        IPX_ERROR(module, "pthread_spin_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__, rc);
-        goto exit_B;
-    }
-
-    // Initialize sync mutex and conditional variables
-    if ((rc = pthread_mutex_init(&ring->sync.mutex, NULL)) != 0) {
-        IPX_ERROR(module, "pthread_mutex_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__, rc);
-        goto exit_C;
-    }
-
-    pthread_condattr_t cond_attr;
-    if ((rc = pthread_condattr_init(&cond_attr)) != 0) {
-        IPX_ERROR(module, "pthread_condattr_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__,
-            rc);
-        goto exit_D;
-    }
-
-    if ((rc = pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC)) != 0) {
-        IPX_ERROR(module, "pthread_condattr_setclock() failed! (%s:%d, err: %d)", __FILE__,
-            __LINE__, rc);
-        goto exit_E;
+        free(ring);
+        return NULL;
     }
-
-    if ((rc = pthread_cond_init(&ring->sync.cond_reader, &cond_attr)) != 0) {
-        IPX_ERROR(module, "pthread_cond_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__, rc);
-        goto exit_E;
+    for (uint32_t i = 0; i < alloc_size; i++) {
+        ring->data[i] = NULL;
     }
 
-    if ((rc = pthread_cond_init(&ring->sync.cond_writer, &cond_attr)) != 0) {
-        IPX_ERROR(module, "pthread_cond_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__, rc);
-        goto exit_F;
+    // Initialize ring variables
+    ring->size = size;
+    ring->mask = alloc_size - 1;
+    ring->div_block = size / 8 > 0 ? size / 8 : 1;
+    ring->spin_max = RING_SPIN_MAX;
+    ring->yields = 0;
+#ifdef _SC_NPROCESSORS_ONLN
+    // The other side cannot make progress while a thread spins on a single CPU
+    if (sysconf(_SC_NPROCESSORS_ONLN) == 1) {
+        ring->spin_max = 0;
     }
-    pthread_condattr_destroy(&cond_attr);
+#endif
+    ring->mw_mode = mw_mode;
 
-    // Initialize ring variables
-    ring->reader.size = size;
-    ring->reader.div_block = size / 8;
-    ring->reader.data_idx = 0;
     ring->reader.read_idx = 0;
-    ring->reader.exchange_idx = 0;
-    ring->reader.read_commit_idx = 0;
     ring->reader.last = 0;
+    ring->reader.spin = ring->spin_max;
 
-    ring->writer.size = size;
-    ring->writer.div_block = size / 8;
-    ring->writer.data_idx = 0;
-    ring->writer.exchange_idx = size; // Amount of empty memory
     ring->writer.write_idx = 0;
-    ring->writer.write_commit_idx = 0;
-
-    ring->sync.read_idx = 0;
-    ring->sync.write_idx = size;
-
-    ring->mw_mode = mw_mode;
+    ring->writer.read_idx = 0;
+    ring->writer.spin = ring->spin_max;
+
+    ring->sync.reader_seq = 0;
+    ring->sync.reader_waiting = 0;
+    ring->sync.writer_seq = 0;
+    ring->sync.writer_waiting = 0;
+    ring->reader_sync = &ring->sync;
     return ring;
-
-    // In case failure
-exit_F:
-    pthread_cond_destroy(&ring->sync.cond_reader);
-exit_E:
-    pthread_condattr_destroy(&cond_attr);
-exit_D:
-    pthread_mutex_destroy(&ring->sync.mutex);
-exit_C:
-    pthread_spin_destroy(&ring->writer_lock);
-exit_B:
-    free(ring->data);
-exit_A:
-    free(ring);
-    return NULL;
 }
 
 void
 ipx_ring_destroy(ipx_ring_t *ring)
 {
-    // The last read message is not confirmed by the reader, it is 1 index behind -> "+ 1"
-    if (ring->reader.read_idx != ring->writer.write_idx) {
-        uint32_t cnt = ring->writer.write_idx - ring->reader.read_idx;
+    // The last read messages are not confirmed by the reader, they are behind the reader head
+    uint32_t cnt = ring->writer.write_idx - ring->reader.read_idx - ring->reader.last;
+    if (cnt != 0) {
         IPX_WARNING(module, "Destroying of a ring buffer that still contains %" PRIu32
             " unprocessed message(s)!", cnt);
     }
 
-    pthread_cond_destroy(&ring->sync.cond_writer);
-    pthread_cond_destroy(&ring->sync.cond_reader);
-    pthread_mutex_destroy(&ring->sync.mutex);
-    pthread_spin_destroy(&ring->writer_lock);
     free(ring->data);
     free(ring);
 }
 
 /**
- * \brief Wrapper around condition wait
- * \param[in] cond  Condition variable
- * \param[in] mutex Locked mutex
- * \param[in] msec  Number of milliseconds to wait
- * \return Same as the function pthread_cond_timedwait
+ * \brief Hint the CPU that the thread is busy-waiting
+ */
+static inline void
+ring_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * \brief Sleep until the futex word changes or a timeout expires
+ * \param[in] addr Futex word
+ * \param[in] val  Expected value of the word (do not sleep if it differs)
+ * \param[in] msec Number of milliseconds to wait
  */
-static inline int
-ring_cond_timedwait(pthread_cond_t *__restrict__ cond, pthread_mutex_t *__restrict__ mutex, long msec)
+static inline void
+ring_futex_wait(uint32_t *addr, uint32_t val, long msec)
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    ts.tv_nsec += msec * 1000000;
-    if (ts.tv_nsec >= 1000000000) {
-        ts.tv_nsec %= 1000000000;
-        ts.tv_sec += 1;
+    struct timespec ts = {msec / 1000, (msec % 1000) * 1000000};
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+#else
+    if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == val) {
+        ts.tv_sec = 0;
+        ts.tv_nsec = 100000;
+        nanosleep(&ts, NULL);
     }
+#endif
+}
 
-    return pthread_cond_timedwait(cond, mutex, &ts);
+/**
+ * \brief Change the futex word and wake up all threads sleeping on it
+ * \param[in] addr Futex word
+ */
+static inline void
+ring_futex_wake(uint32_t *addr)
+{
+    __atomic_fetch_add(addr, 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
 }
 
 /**
- * \brief Get a new empty field
+ * \brief Adapt number of busy-wait iterations to the result of the last wait
  *
- * \note The function blocks until a required memory is ready. Before the next call of this
- *   function, the function ipx_ring_commit() MUST be called first, to commit performed
- *   modifications.
+ * Spinning is extended when it paid off and shortened when the thread had to sleep anyway.
+ * \param[in,out] spin     Current number of iterations
+ * \param[in]     spin_max Upper limit of iterations
+ * \param[in]     success  The wait has been finished by spinning
+ */
+static inline void
+ring_spin_adapt(uint32_t *spin, uint32_t spin_max, bool success)
+{
+    if (success) {
+        *spin = *spin * 2 < spin_max ? *spin * 2 : spin_max;
+    } else {
+        *spin = *spin / 2 > RING_SPIN_MIN ? *spin / 2 : RING_SPIN_MIN;
+    }
+    if (*spin > spin_max) {
+        *spin = spin_max;
+    }
+}
+
+/**
+ * \brief Get number of fields that a writer can reserve at the moment
  * \param[in] ring Ring buffer
- * \return Pointer to a unused place in the buffer
+ * \param[in] idx  Writer head
+ * \return Number of empty fields
  */
-static inline ipx_msg_t **
-ipx_ring_begin(ipx_ring_t *ring)
+static inline uint32_t
+ring_space(ipx_ring_t *ring, uint32_t idx)
 {
-    // Prepare the next pointer to write
-    ipx_msg_t **msg = &ring->data[ring->writer.data_idx];
+    uint32_t read_idx = __atomic_load_n(&ring->writer.read_idx, __ATOMIC_ACQUIRE);
+    if (idx - read_idx < ring->size) {
+        return ring->size - (idx - read_idx);
+    }
+
+    // The hint says the buffer is full, load the current reader head
+    read_idx = __atomic_load_n(&ring->reader.read_idx, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&ring->writer.read_idx, read_idx, __ATOMIC_RELEASE);
+    return ring->size - (idx - read_idx);
+}
 
-    // Is there enough space?
-    if (ring->writer.exchange_idx - ring->writer.write_idx > 0) {
-        return msg;
+/**
+ * \brief Wait until the reader releases at least one field after the writer head
+ * \note The function blocks until a required memory is ready.
+ * \param[in] ring Ring buffer
+ * \param[in] idx  Writer head
+ */
+static void
+ring_writer_wait(ipx_ring_t *ring, uint32_t idx)
+{
+    uint32_t spin = __atomic_load_n(&ring->writer.spin, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < spin; i++) {
+        ring_pause();
+        if (ring_space(ring, idx) > 0) {
+            ring_spin_adapt(&spin, ring->spin_max, true);
+            __atomic_store_n(&ring->writer.spin, spin, __ATOMIC_RELAXED);
+            return;
+        }
     }
+    ring_spin_adapt(&spin, ring->spin_max, false);
+    __atomic_store_n(&ring->writer.spin, spin, __ATOMIC_RELAXED);
 
-    // Get an empty space -> reader-writer synchronization
-    pthread_mutex_lock(&ring->sync.mutex);
-    ring->writer.exchange_idx = ring->sync.write_idx;
-    while (ring->writer.exchange_idx - ring->writer.write_idx == 0) {
-        // After sync the buffer is still full, try again later
-        pthread_cond_signal(&ring->sync.cond_reader);
-        ring_cond_timedwait(&ring->sync.cond_writer, &ring->sync.mutex, 10);
-        ring->writer.exchange_idx = ring->sync.write_idx;
+    for (uint32_t i = 0; i < ring->yields; i++) {
+        sched_yield();
+        if (ring_space(ring, idx) > 0) {
+            return;
+        }
     }
-    pthread_cond_signal(&ring->sync.cond_reader);
-    pthread_mutex_unlock(&ring->sync.mutex);
 
-    assert(ring->writer.exchange_idx - ring->writer.write_idx > 0);
-    return msg;
+    while (1) {
+        uint32_t seq = __atomic_load_n(&ring->sync.writer_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&ring->sync.writer_waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (ring_space(ring, idx) > 0) {
+            return;
+        }
+        ring_futex_wait(&ring->sync.writer_seq, seq, RING_WRITER_TIMEOUT);
+    }
 }
 
 /**
- * \brief Commit modifications of memory
- * \param[in] ring Ring buffer
+ * \brief Reserve fields for a writer
+ *
+ * \note The function blocks until at least one field is empty.
+ * \param[in]  ring Ring buffer
+ * \param[in]  cnt  Maximal number of fields to reserve
+ * \param[out] idx  Writer head, i.e. the first reserved field
+ * \return Number of reserved fields (at least 1)
  */
-static inline void
-ipx_ring_commit(ipx_ring_t *ring)
+static inline uint32_t
+ring_reserve(ipx_ring_t *ring, uint32_t cnt, uint32_t *idx)
 {
-    register uint32_t new_idx = 1;
-    ring->writer.data_idx++;
+    uint32_t head = __atomic_load_n(&ring->writer.write_idx, __ATOMIC_RELAXED);
+    uint32_t space;
 
-    if (ring->writer.size == ring->writer.data_idx) {
-        // End of the ring buffer has been reached -> skip to the beginning
-        ring->writer.data_idx = 0;
+    if (!ring->mw_mode) {
+        while ((space = ring_space(ring, head)) == 0) {
+            ring_writer_wait(ring, head);
+        }
+        cnt = cnt < space ? cnt : space;
+        __atomic_store_n(&ring->writer.write_idx, head + cnt, __ATOMIC_RELAXED);
+        *idx = head;
+        return cnt;
     }
 
-    // Atomic update of writer index (Note: new_idx will be the same as writer.write_idx)
-    new_idx += __sync_fetch_and_add(&ring->writer.write_idx, new_idx);
+    while (1) {
+        space = ring_space(ring, head);
+        if (space == 0) {
+            ring_writer_wait(ring, head);
+            head = __atomic_load_n(&ring->writer.write_idx, __ATOMIC_RELAXED);
+            continue;
+        }
+        uint32_t reserve = cnt < space ? cnt : space;
+        if (__atomic_compare_exchange_n(&ring->writer.write_idx, &head, head + reserve, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *idx = head;
+            return reserve;
+        }
+    }
+}
+
+/**
+ * \brief Wake up the reader if it is sleeping on an empty buffer
+ * \param[in] ring Ring buffer
+ */
+static inline void
+ring_wake_reader(ipx_ring_t *ring)
+{
+    struct ring_sync *sync = ring->reader_sync;
 
-    // Sync positions with a reader, if necessary
-    if (new_idx - ring->writer.write_commit_idx >= ring->writer.div_block) {
-        pthread_mutex_lock(&ring->sync.mutex);
-        ring->sync.read_idx = new_idx;
-        ring->writer.exchange_idx = ring->sync.write_idx;
-        ring->writer.write_commit_idx = new_idx;
-        pthread_cond_signal(&ring->sync.cond_reader);
-        pthread_mutex_unlock(&ring->sync.mutex);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sync->reader_waiting, __ATOMIC_RELAXED)
+            && __atomic_exchange_n(&sync->reader_waiting, 0, __ATOMIC_RELAXED)) {
+        ring_futex_wake(&sync->reader_seq);
     }
 }
 
 void
 ipx_ring_push(ipx_ring_t *ring, ipx_msg_t *msg)
 {
-    ipx_msg_t **msg_space;
+    uint32_t idx;
+
+    assert(msg != NULL);
+    ring_reserve(ring, 1, &idx);
+    __atomic_store_n(&ring->data[idx & ring->mask], msg, __ATOMIC_RELEASE);
+    ring_wake_reader(ring);
+}
 
-    if (ring->mw_mode) {
-        pthread_spin_lock(&ring->writer_lock);
+void
+ipx_ring_push_bulk(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t cnt)
+{
+    while (cnt > 0) {
+        uint32_t idx;
+        uint32_t reserved = ring_reserve(ring, cnt, &idx);
+        for (uint32_t i = 0; i < reserved; i++) {
+            assert(msgs[i] != NULL);
+            __atomic_store_n(&ring->data[(idx + i) & ring->mask], msgs[i], __ATOMIC_RELEASE);
+        }
+        ring_wake_reader(ring);
+        msgs += reserved;
+        cnt -= reserved;
     }
+}
 
-    msg_space = ipx_ring_begin(ring);
-    *msg_space = msg;
-    ipx_ring_commit(ring);
+/**
+ * \brief Release messages returned by the previous read to writers
+ * \param[in] ring Ring buffer
+ */
+static inline void
+ring_release(ipx_ring_t *ring)
+{
+    if (ring->reader.last == 0) {
+        return;
+    }
+
+    uint32_t read_idx = ring->reader.read_idx;
+    for (uint32_t i = 0; i < ring->reader.last; i++) {
+        __atomic_store_n(&ring->data[(read_idx + i) & ring->mask], NULL, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&ring->reader.read_idx, read_idx + ring->reader.last, __ATOMIC_RELEASE);
+    ring->reader.last = 0;
 
-    if (ring->mw_mode) {
-        pthread_spin_unlock(&ring->writer_lock);
+    // Writers are woken up when a block of fields is empty, an empty buffer always wakes them up
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sync.writer_waiting, __ATOMIC_RELAXED)
+            && ring->size - ipx_ring_cnt(ring) >= ring->div_block
+            && __atomic_exchange_n(&ring->sync.writer_waiting, 0, __ATOMIC_RELAXED)) {
+        ring_futex_wake(&ring->sync.writer_seq);
     }
 }
 
+/**
+ * \brief Get a message at the reader head (if already written)
+ * \param[in] ring Ring buffer
+ * \return Pointer to the message or NULL
+ */
+static inline ipx_msg_t *
+ring_head(ipx_ring_t *ring)
+{
+    return __atomic_load_n(&ring->data[ring->reader.read_idx & ring->mask], __ATOMIC_ACQUIRE);
+}
 
-ipx_msg_t *
-ipx_ring_pop(ipx_ring_t *ring)
+/**
+ * \brief Find the first ring with a message at the reader head
+ * \param[in]  rings Ring buffers
+ * \param[in]  cnt   Number of ring buffers
+ * \param[in]  start Index of the ring to check first
+ * \param[out] msg   Pointer to the message (NULL if all rings are empty)
+ * \return Index of the ring (\p cnt if all rings are empty)
+ */
+static inline uint32_t
+ring_find(ipx_ring_t **rings, uint32_t cnt, uint32_t start, ipx_msg_t **msg)
 {
-    // Consider previous memory block as processed
-    ring->reader.data_idx += ring->reader.last;
-    ring->reader.read_idx += ring->reader.last;
-    ring->reader.last = 0;
+    uint32_t idx = start;
+    for (uint32_t i = 0; i < cnt; i++) {
+        if ((*msg = ring_head(rings[idx])) != NULL) {
+            return idx;
+        }
+        if (++idx == cnt) {
+            idx = 0;
+        }
+    }
+    return cnt;
+}
 
-    if (ring->reader.size == ring->reader.data_idx) {
-        // The end of the ring buffer has been reached -> skip to the beginning
-        ring->reader.data_idx = 0;
+/**
+ * \brief Wait until a message is written at the reader head of any ring or a timeout expires
+ *
+ * The reader sleeps on the sync structure of the first ring, i.e. the rings must be grouped.
+ * \param[in]  rings Ring buffers
+ * \param[in]  cnt   Number of ring buffers
+ * \param[in]  start Index of the ring to check first
+ * \param[out] msg   Pointer to the message (NULL on timeout)
+ * \return Index of the ring (\p cnt on timeout)
+ */
+static uint32_t
+ring_reader_wait(ipx_ring_t **rings, uint32_t cnt, uint32_t start, ipx_msg_t **msg)
+{
+    ipx_ring_t *ring = rings[0];
+    struct ring_sync *sync = ring->reader_sync;
+    uint32_t idx;
+
+    for (uint32_t i = 0; i < ring->reader.spin; i++) {
+        ring_pause();
+        if ((idx = ring_find(rings, cnt, start, msg)) != cnt) {
+            ring_spin_adapt(&ring->reader.spin, ring->spin_max, true);
+            return idx;
+        }
     }
+    ring_spin_adapt(&ring->reader.spin, ring->spin_max, false);
 
-    // Prepare the next pointer to read
-    ipx_msg_t **msg = &ring->data[ring->reader.data_idx];
+    for (uint32_t i = 0; i < ring->yields; i++) {
+        sched_yield();
+        if ((idx = ring_find(rings, cnt, start, msg)) != cnt) {
+            return idx;
+        }
+    }
 
-    // Sync positions with writers, if necessary
-    if (ring->reader.read_idx - ring->reader.read_commit_idx >= ring->reader.div_block) {
-        pthread_mutex_lock(&ring->sync.mutex);
-        ring->sync.write_idx += ring->reader.read_idx - ring->reader.read_commit_idx;
-        ring->reader.exchange_idx = ring->sync.read_idx;
-        ring->reader.read_commit_idx = ring->reader.read_idx;
-        pthread_cond_signal(&ring->sync.cond_writer);
-        pthread_mutex_unlock(&ring->sync.mutex);
+    uint32_t seq = __atomic_load_n(&sync->reader_seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&sync->reader_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ((idx = ring_find(rings, cnt, start, msg)) == cnt) {
+        ring_futex_wait(&sync->reader_seq, seq, RING_READER_TIMEOUT);
+        idx = ring_find(rings, cnt, start, msg);
     }
+    __atomic_store_n(&sync->reader_waiting, 0, __ATOMIC_RELAXED);
+    return idx;
+}
 
-    if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
-        // Ok, the reader owns this part of the buffer
-        // TODO: prefetch
-        ring->reader.last = 1;
-        return *msg; // Now, we can dereference the pointer
+/**
+ * \brief Take up to \p max messages from the reader head
+ * \param[in]  ring Ring buffer
+ * \param[in]  msg  Message at the reader head
+ * \param[out] msgs Array for the messages
+ * \param[in]  max  Size of the array (at least 1)
+ * \return Number of messages
+ */
+static inline uint32_t
+ring_take(ipx_ring_t *ring, ipx_msg_t *msg, ipx_msg_t **msgs, uint32_t max)
+{
+    if (max > ring->size) {
+        max = ring->size;
     }
 
-    while (1) {
-        // The reader has reached the end of the filled memory -> try to sync
-        pthread_mutex_lock(&ring->sync.mutex);
-        pthread_cond_signal(&ring->sync.cond_writer);
-        // Wait until a writer sends a signal or a timeout expires
-        ring_cond_timedwait(&ring->sync.cond_reader, &ring->sync.mutex, 10);
-        ring->reader.exchange_idx = ring->sync.read_idx;
-        pthread_mutex_unlock(&ring->sync.mutex);
-
-        if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
-            // TODO: prefetch
-            ring->reader.last = 1;
-            return *msg; // Now, we can dereference the pointer
+    uint32_t read_idx = ring->reader.read_idx;
+    uint32_t cnt = 0;
+    do {
+        msgs[cnt++] = msg;
+        if (cnt == max) {
+            break;
         }
+        msg = __atomic_load_n(&ring->data[(read_idx + cnt) & ring->mask], __ATOMIC_ACQUIRE);
+    } while (msg != NULL);
 
-        // Writer still didn't perform sync -> try to steal all committed messages from writer
-        pthread_mutex_lock(&ring->sync.mutex);
-        ring->sync.read_idx = ring->reader.exchange_idx = __sync_fetch_and_add(&ring->writer.write_idx, 0);
-        pthread_mutex_unlock(&ring->sync.mutex);
+    ring->reader.last = cnt;
+    return cnt;
+}
 
-        if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
-            // TODO: prefetch
-            ring->reader.last = 1;
-            return *msg; // Now, we can dereference the pointer
-        }
-        break;
+ipx_msg_t *
+ipx_ring_pop(ipx_ring_t *ring)
+{
+    // Consider previous message as processed
+    ring_release(ring);
+
+    ipx_msg_t *msg = ring_head(ring);
+    if (msg == NULL && ring_reader_wait(&ring, 1, 0, &msg) != 0) {
+        return NULL;
     }
-    return NULL;
+    ring->reader.last = 1;
+    return msg;
+}
+
+uint32_t
+ipx_ring_pop_bulk(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t max)
+{
+    // Consider previous messages as processed
+    ring_release(ring);
+
+    if (max == 0) {
+        return 0;
+    }
+    ipx_msg_t *msg = ring_head(ring);
+    if (msg == NULL && ring_reader_wait(&ring, 1, 0, &msg) != 0) {
+        return 0;
+    }
+    return ring_take(ring, msg, msgs, max);
+}
+
+void
+ipx_ring_group(ipx_ring_t **rings, uint32_t cnt)
+{
+    for (uint32_t i = 0; i < cnt; i++) {
+        rings[i]->reader_sync = &rings[0]->sync;
+    }
+}
+
+uint32_t
+ipx_ring_pop_bulk_any(ipx_ring_t **rings, uint32_t cnt, uint32_t *next, ipx_msg_t **msgs,
+    uint32_t max)
+{
+    // Consider previous messages as processed (they can be in any of the rings)
+    for (uint32_t i = 0; i < cnt; i++) {
+        ring_release(rings[i]);
+    }
+
+    if (cnt == 0 || max == 0) {
+        return 0;
+    }
+    if (*next >= cnt) {
+        *next = 0;
+    }
+    ipx_msg_t *msg;
+    uint32_t idx = ring_find(rings, cnt, *next, &msg);
+    if (idx == cnt && (idx = ring_reader_wait(rings, cnt, *next, &msg)) == cnt) {
+        return 0;
+    }
+
+    // The next call starts behind this ring, so a busy ring cannot starve the others
+    *next = idx + 1 < cnt ? idx + 1 : 0;
+    return ring_take(rings[idx], msg, msgs, max);
 }
 
 void
@@ -464,8 +660,18 @@ ipx_ring_mw_mode(ipx_ring_t *ring, bool mode)
     ring->mw_mode = mode;
 }
 
+void
+ipx_ring_idle(ipx_ring_t *ring, uint32_t spin, uint32_t yields)
+{
+    ring->spin_max = spin;
+    ring->yields = yields;
+    ring->reader.spin = spin;
+    ring->writer.spin = spin;
+}
+
 IPX_API uint32_t
 ipx_ring_cnt(ipx_ring_t *ring)
 {
-   return ring->writer.write_idx - ring->reader.read_idx;
+   return __atomic_load_n(&ring->writer.write_idx, __ATOMIC_RELAXED) -
+      __atomic_load_n(&ring->reader.read_idx, __ATOMIC_RELAXED);
 }
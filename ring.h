@@ -63,6 +63,11 @@ typedef void ipx_msg_t;
  * from one or more produces to a single reader. The ring buffer is supposed to be used as a part
  * of IPFIXcol internal message pipeline.
  *
+ * The buffer is lock-free. Reader and writer heads live on separate cache lines, a single writer
+ * moves its head by a plain store and multiple writers reserve space by compare-and-swap. A thread
+ * waiting for a message (or for an empty field) spins for an adaptive number of iterations first,
+ * then yields the CPU a few times and then sleeps on a futex until the other side wakes it up.
+ *
  * @{
  */
 
@@ -103,17 +108,78 @@ ipx_ring_destroy(ipx_ring_t *ring);
 IPX_API void
 ipx_ring_push(ipx_ring_t *ring, ipx_msg_t *msg);
 
+/**
+ * \brief Add messages into the ring buffer
+ *
+ * Same as ipx_ring_push(), but space is reserved for as many messages as possible at once.
+ * Messages of one call are stored in order, however, in multi-writer mode, they can be
+ * interleaved with messages of other writers when the buffer is almost full.
+ * \note The function blocks until all messages are added.
+ * \param[in] ring Ring buffer
+ * \param[in] msgs Messages to be added into the ring buffer (must not be NULL)
+ * \param[in] cnt  Number of messages
+ */
+IPX_API void
+ipx_ring_push_bulk(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t cnt);
+
 /**
  * \brief Get a message from the ring buffer
  *
- * \note The function blocks until the message is ready.
+ * The message stays in the buffer until the next call of this function (or ipx_ring_pop_bulk()),
+ * i.e. a writer cannot overwrite it while it is being processed.
+ * \note The function waits for the message up to 10 milliseconds.
  * \warning Cannot be used concurrently by multiple threads at the same time.
  * \param[in] ring Ring buffer
- * \return Pointer to the message
+ * \return Pointer to the message or NULL (timeout)
  */
 IPX_API ipx_msg_t *
 ipx_ring_pop(ipx_ring_t *ring);
 
+/**
+ * \brief Get up to \p max messages from the ring buffer
+ *
+ * The messages stay in the buffer until the next call of this function (or ipx_ring_pop()).
+ * \note The function waits for the first message up to 10 milliseconds.
+ * \warning Cannot be used concurrently by multiple threads at the same time.
+ * \param[in]  ring Ring buffer
+ * \param[out] msgs Array for the messages
+ * \param[in]  max  Size of the array
+ * \return Number of messages (0 on timeout)
+ */
+IPX_API uint32_t
+ipx_ring_pop_bulk(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t max);
+
+/**
+ * \brief Let a single reader wait for messages in any of the ring buffers
+ *
+ * Writers of all the rings wake up the reader through the first ring, so the reader can read the
+ * rings by ipx_ring_pop_bulk_any(). The first ring must be destroyed as the last one.
+ * \warning During this function call, nobody may use the buffers.
+ * \param[in] rings Ring buffers
+ * \param[in] cnt   Number of ring buffers
+ */
+IPX_API void
+ipx_ring_group(ipx_ring_t **rings, uint32_t cnt);
+
+/**
+ * \brief Get up to \p max messages from one of grouped ring buffers
+ *
+ * Rings are checked round-robin from \p next, the messages are taken from the first non-empty
+ * one and \p next is moved behind it, so a busy ring cannot starve the others. The messages
+ * stay in the buffer until the next call of this function.
+ * \note The function waits for the first message in any ring up to 10 milliseconds.
+ * \warning Cannot be used concurrently by multiple threads at the same time.
+ * \param[in]     rings Ring buffers grouped by ipx_ring_group()
+ * \param[in]     cnt   Number of ring buffers
+ * \param[in,out] next  Index of the ring to check first
+ * \param[out]    msgs  Array for the messages
+ * \param[in]     max   Size of the array
+ * \return Number of messages (0 on timeout)
+ */
+IPX_API uint32_t
+ipx_ring_pop_bulk_any(ipx_ring_t **rings, uint32_t cnt, uint32_t *next, ipx_msg_t **msgs,
+    uint32_t max);
+
 /**
  * \brief Change (i.e. disable/enable) multi-writer mode
  *
@@ -126,6 +192,20 @@ ipx_ring_pop(ipx_ring_t *ring);
 IPX_API void
 ipx_ring_mw_mode(ipx_ring_t *ring, bool mode);
 
+/**
+ * \brief Set how a reader or writer waits before it goes to sleep
+ *
+ * A waiting thread busy-waits first. The number of iterations adapts between a small minimum
+ * and \p spin, zero disables busy-waiting. Then the thread yields the CPU \p yields times.
+ * By default, threads spin up to 4096 iterations (none on single-CPU systems) and do not yield.
+ * \warning During this function call, nobody may use the buffer.
+ * \param[in] ring   Ring buffer
+ * \param[in] spin   Maximal number of busy-wait iterations
+ * \param[in] yields Number of yields
+ */
+IPX_API void
+ipx_ring_idle(ipx_ring_t *ring, uint32_t spin, uint32_t yields);
+
 IPX_API uint32_t
 ipx_ring_cnt(ipx_ring_t *ring);
 
@@ -0,0 +1,13 @@
+#!/bin/sh
+
+test -z "$srcdir" && export srcdir=.
+
+. $srcdir/test_plugin.sh
+
+run_option_test aggregation aggregation basic "$pcap_dir/mixed-sample.pcap" -g src/24/48,dst/24/48,proto,dport || exit $?
+
+# Reply packets have to update the aggregate of their flow, so there are fewer records than flows.
+if [ `wc -l < "$output_dir/aggregation"` -ge `wc -l < "$ref_dir/basic"` ]; then
+   echo "aggregation does not reduce number of records"
+   exit 1
+fi
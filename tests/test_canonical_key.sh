@@ -0,0 +1,8 @@
+#!/bin/sh
+
+test -z "$srcdir" && export srcdir=.
+
+. $srcdir/test_plugin.sh
+
+# Canonical flow keys change only the lookup, flows have to be the same as without them.
+run_option_test canonical_key basic basic "$pcap_dir/mixed-sample.pcap" -k
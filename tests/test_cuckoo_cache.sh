@@ -0,0 +1,8 @@
+#!/bin/sh
+
+test -z "$srcdir" && export srcdir=.
+
+. $srcdir/test_plugin.sh
+
+# Cuckoo flow cache has to produce the same flows as the default one.
+run_option_test cuckoo_cache basic basic "$pcap_dir/mixed-sample.pcap" -E cuckoo
@@ -19,8 +19,9 @@ ref_dir=$srcdir/test_reference
 output_dir=./test_output
 file_out="$$.data"
 
-# Usage: run_plugin_test <plugin> <data file>
-run_plugin_test() {
+# Usage: check_test_env
+# Returns 77 (skip) when the test cannot be run.
+check_test_env() {
    if ! [ -f "$ipfixprobe_bin" ]; then
       echo "ipfixprobe not compiled"
       return 77
@@ -39,6 +40,11 @@ run_plugin_test() {
    if ! [ -d "$output_dir" ]; then
       mkdir "$output_dir"
    fi
+}
+
+# Usage: run_plugin_test <plugin> <data file>
+run_plugin_test() {
+   check_test_env || return $?
 
    "$ipfixprobe_bin" -i f:"$output_dir/$file_out":buffer=off:timeout=WAIT -p "$1" -L 0 -r "$2" >/dev/null
    "$logger_bin"     -i f:"$output_dir/$file_out" -t | sort > "$output_dir/$1"
@@ -52,3 +58,25 @@ run_plugin_test() {
    fi
 }
 
+# Usage: run_option_test <test name> <reference> <plugin> <data file> [ipfixprobe options]
+# Output is compared with test_reference/<reference> and kept in test_output/<test name>.
+run_option_test() {
+   check_test_env || return $?
+
+   name=$1
+   ref=$2
+   plugin=$3
+   data=$4
+   shift 4
+
+   "$ipfixprobe_bin" -i f:"$output_dir/$file_out":buffer=off:timeout=WAIT -p "$plugin" -L 0 -r "$data" "$@" >/dev/null
+   "$logger_bin"     -i f:"$output_dir/$file_out" -t | sort > "$output_dir/$name"
+   rm "$output_dir/$file_out"
+
+   if sort "$ref_dir/$ref" | diff -u "$output_dir/$name" -s - ; then
+      echo "$name test OK"
+   else
+      echo "$name test FAILED"
+      return 1
+   fi
+}
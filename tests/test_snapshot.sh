@@ -0,0 +1,30 @@
+#!/bin/sh
+
+test -z "$srcdir" && export srcdir=.
+
+. $srcdir/test_plugin.sh
+
+check_test_env || exit $?
+
+snapshot="$output_dir/$$.snapshot"
+rm -f "$snapshot"
+
+# Flows still in the cache at the end of the capture are saved instead of exported.
+"$ipfixprobe_bin" -i f:"$output_dir/$file_out":buffer=off:timeout=WAIT -p basic -L 0 -r "$pcap_dir/mixed-sample.pcap" -w "$snapshot" >/dev/null
+"$logger_bin"     -i f:"$output_dir/$file_out" -t > "$output_dir/snapshot"
+rm "$output_dir/$file_out"
+
+# Second run only restores the saved flows, the filter drops every packet, so they are exported on exit.
+"$ipfixprobe_bin" -i f:"$output_dir/$file_out":buffer=off:timeout=WAIT -p basic -L 0 -r "$pcap_dir/mixed-sample.pcap" -F "ip and not ip" -w "$snapshot:restore" >/dev/null
+"$logger_bin"     -i f:"$output_dir/$file_out" -t | tail -n +2 >> "$output_dir/snapshot"
+rm "$output_dir/$file_out"
+rm -f "$snapshot"
+
+# Together, both runs export the same flows as a single run without the snapshot.
+sort -o "$output_dir/snapshot" "$output_dir/snapshot"
+if sort "$ref_dir/basic" | diff -u "$output_dir/snapshot" -s - ; then
+   echo "snapshot test OK"
+else
+   echo "snapshot test FAILED"
+   exit 1
+fi